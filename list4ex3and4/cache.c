@@ -0,0 +1,932 @@
+/*
+ * cache.c
+ * Command result cache: 'cache CMD...' replays the recorded output of a command line
+ * instead of running it again, as long as nothing it depends on has changed
+ *
+ * The key of a command line hashes its' words and redirections, the working directory,
+ * the relevant environment and the (device, inode, size, mtime) of every file named in it.
+ * Layout of the store ($LSH_CACHE_DIR, or $XDG_CACHE_HOME/lsh, or ~/.cache/lsh):
+ *   entries/<key> - exit status and outputs of a command line
+ *   blobs/<hash>  - the outputs themselves, addressed by the hash of their content
+ *   tmp/          - outputs being recorded
+ *   stats         - number of hits and misses
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+#include "default_functions.h"
+#include "descriptors.h"
+#include "executor.h"
+#include "sha256.h"
+
+#define CACHE_FORMAT "lsh-cache-1" // Changes whenever the key or the entries change their format
+#define MAX_OUTPUTS_PER_ENTRY (2 + 2 * MAX_COMMANDS_PER_PIPELINE) // stdout, stderr and the redirected files
+#define STALE_TEMPORARY_FILE_AGE 86400 // Files left in tmp/ by crashed shells are removed after a day
+
+// Variables which change the output of most commands, on top of the ones listed in LSH_CACHE_ENV
+static const char *key_variables[] = { "PATH", "LANG", "LC_ALL", "LC_COLLATE", "LC_CTYPE", "LC_NUMERIC", "TZ" };
+
+/*
+ * A single output of the command line, stored as a blob
+ */
+typedef struct cache_output {
+  char kind[8]; // stdout, stderr or file
+  char hash[SHA256_HEX_SIZE];
+  long long size;
+  char path[PATH_MAX]; // Name of the redirected file
+} cache_output;
+
+/*
+ * Contents of entries/<key>
+ */
+typedef struct cache_entry {
+  int status;
+  cache_output outputs[MAX_OUTPUTS_PER_ENTRY];
+  int output_count;
+} cache_entry;
+
+/*
+ * Output of the commands recorded into a temporary file while it's passed on
+ */
+typedef struct cache_recording {
+  int fd;
+  char path[PATH_MAX];
+  sha256_ctx hash;
+  long long size;
+  bool failed;
+} cache_recording;
+
+/*
+ * State of the output callback used while the command line runs for the first time
+ */
+typedef struct cache_recorder {
+  cache_recording streams[3]; // Indexed with LSH_STDOUT/LSH_STDERR
+  lsh_output_callback callback; // The callback of the context, if any
+  void *user_data;
+} cache_recorder;
+
+/**
+ * Writes the whole buffer, retrying the partial writes
+ */
+static bool write_all(int fd, const char *data, size_t length) {
+  ssize_t written;
+
+  while (length > 0) {
+    if ((written = write(fd, data, length)) == -1) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    data += written;
+    length -= written;
+  }
+  return true;
+}
+
+/**
+ * Copies the file without passing the data through the shell (sendfile),
+ * falling back to read/write where the kernel does not support it
+ */
+static bool copy_file(int source_fd, int target_fd, long long size) {
+  char buffer[65536];
+  ssize_t count;
+  off_t offset = 0;
+
+  while (offset < size) {
+    count = sendfile(target_fd, source_fd, &offset, size - offset);
+    if (count > 0)
+      continue;
+    if (count == -1 && errno == EINTR)
+      continue;
+    if (count == 0 || (errno != EINVAL && errno != ENOSYS))
+      return false;
+
+    // sendfile() refuses eg. descriptors opened with O_APPEND
+    while (offset < size) {
+      if ((count = pread(source_fd, buffer, sizeof(buffer), offset)) <= 0)
+        return false;
+      if (!write_all(target_fd, buffer, count))
+        return false;
+      offset += count;
+    }
+  }
+  return true;
+}
+
+/**
+ * Finds the directory of the store and creates it, if needed
+ */
+static bool find_store(lsh_ctx *ctx, char store[PATH_MAX]) {
+  const char *subdirectories[] = { "", "/entries", "/blobs", "/tmp" };
+  const char *directory;
+  char path[PATH_MAX];
+  int length;
+
+  if ((directory = lsh_getenv(ctx, "LSH_CACHE_DIR")) != NULL && directory[0] != '\0')
+    length = snprintf(store, PATH_MAX, "%s", directory);
+  else if ((directory = lsh_getenv(ctx, "XDG_CACHE_HOME")) != NULL && directory[0] != '\0')
+    length = snprintf(store, PATH_MAX, "%s/lsh", directory);
+  else if ((directory = lsh_getenv(ctx, "HOME")) != NULL)
+    length = snprintf(store, PATH_MAX, "%s/.cache/lsh", directory);
+  else
+    return false;
+
+  if (length >= PATH_MAX - 64)
+    return false;
+
+  // ~/.cache may not exist yet either
+  if (strcmp(store + length - 4, "/lsh") == 0) {
+    snprintf(path, sizeof(path), "%.*s", length - 4, store);
+    mkdir(path, 0700);
+  }
+
+  for (int i = 0; i < 4; i++) {
+    snprintf(path, sizeof(path), "%s%s", store, subdirectories[i]);
+    if (mkdir(path, 0700) == -1 && errno != EEXIST)
+      return false;
+  }
+  return true;
+}
+
+/**
+ * Adds the fingerprint of the file to the key, if the word names one
+ */
+static void hash_file_fingerprint(sha256_ctx *key, int directory_fd, const char *word) {
+  struct stat info;
+  char fingerprint[128];
+
+  if (fstatat(directory_fd, word, &info, 0) == -1)
+    return;
+
+  snprintf(fingerprint, sizeof(fingerprint), "%llu:%llu:%lld:%lld.%09ld",
+      (unsigned long long) info.st_dev, (unsigned long long) info.st_ino, (long long) info.st_size,
+      (long long) info.st_mtim.tv_sec, info.st_mtim.tv_nsec);
+  sha256_update(key, "file", 5);
+  sha256_update(key, word, strlen(word) + 1);
+  sha256_update(key, fingerprint, strlen(fingerprint) + 1);
+}
+
+/**
+ * Adds the variable to the key, telling the unset ones from the empty ones
+ */
+static void hash_variable(sha256_ctx *key, lsh_ctx *ctx, const char *name) {
+  const char *value = lsh_getenv(ctx, name);
+
+  sha256_update(key, name, strlen(name) + 1);
+  if (value != NULL)
+    sha256_update(key, value, strlen(value) + 1);
+  else
+    sha256_update(key, "", 0);
+}
+
+/**
+ * Adds the redirection to the key, if there is one
+ */
+static void hash_redirection(sha256_ctx *key, const char *operator, const char *file) {
+  if (file == NULL)
+    return;
+  sha256_update(key, operator, strlen(operator) + 1);
+  sha256_update(key, file, strlen(file) + 1);
+}
+
+/**
+ * Hashes everything the output of the command line depends on
+ */
+static void compute_key(lsh_ctx *ctx, lsh_pipeline *pipeline, char key_hex[SHA256_HEX_SIZE]) {
+  const char *variables;
+  char *names, *name, *saveptr;
+  lsh_command *command;
+  sha256_ctx key;
+  int directory_fd, i, j;
+
+  sha256_init(&key);
+  sha256_update(&key, CACHE_FORMAT, sizeof(CACHE_FORMAT));
+  sha256_update(&key, ctx->cwd, strlen(ctx->cwd) + 1);
+
+  // The words and redirections of every command
+  for (i = 0; i < pipeline->command_count; i++) {
+    command = &pipeline->commands[i];
+    sha256_update(&key, "|", 2);
+    for (j = 0; j < command->argc; j++)
+      sha256_update(&key, command->argv[j], strlen(command->argv[j]) + 1);
+    hash_redirection(&key, "<", command->input_file);
+    hash_redirection(&key, ">", command->output_file);
+    hash_redirection(&key, "2>", command->error_file);
+  }
+
+  // The environment: the usual suspects, the ones listed in LSH_CACHE_ENV and the context's own
+  for (i = 0; i < (int) (sizeof(key_variables) / sizeof(char *)); i++)
+    hash_variable(&key, ctx, key_variables[i]);
+  if ((variables = lsh_getenv(ctx, "LSH_CACHE_ENV")) != NULL && (names = strdup(variables)) != NULL) {
+    for (name = strtok_r(names, ":", &saveptr); name != NULL; name = strtok_r(NULL, ":", &saveptr))
+      hash_variable(&key, ctx, name);
+    free(names);
+  }
+  for (i = 0; i < ctx->environment_count; i++)
+    sha256_update(&key, ctx->environment[i], strlen(ctx->environment[i]) + 1);
+
+  // The files named in the arguments and the input redirections
+  if ((directory_fd = open(ctx->cwd, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) != -1) {
+    for (i = 0; i < pipeline->command_count; i++) {
+      command = &pipeline->commands[i];
+      for (j = 0; j < command->argc; j++)
+        hash_file_fingerprint(&key, directory_fd, command->argv[j]);
+      if (command->input_file != NULL)
+        hash_file_fingerprint(&key, directory_fd, command->input_file);
+    }
+    close(directory_fd);
+  }
+
+  sha256_final_hex(&key, key_hex);
+}
+
+/**
+ * Reads entries/<key>. Returns false if there's no such entry, or it's damaged.
+ */
+static bool read_entry(const char *path, cache_entry *entry) {
+  FILE *file = fopen(path, "re");
+  char line[PATH_MAX + 128];
+  cache_output *output;
+  int offset;
+  bool valid;
+
+  if (file == NULL)
+    return false;
+
+  entry->output_count = 0;
+  valid = fgets(line, sizeof(line), file) != NULL && strcmp(line, CACHE_FORMAT "\n") == 0;
+  valid = valid && fscanf(file, "status %d\n", &entry->status) == 1;
+
+  while (valid && fgets(line, sizeof(line), file) != NULL) {
+    if (entry->output_count == MAX_OUTPUTS_PER_ENTRY) {
+      valid = false;
+      break;
+    }
+    output = &entry->outputs[entry->output_count++];
+    line[strcspn(line, "\n")] = '\0';
+    offset = 0;
+    if (sscanf(line, "%7s %64s %lld %n", output->kind, output->hash, &output->size, &offset) < 3 || strlen(output->hash) != SHA256_HEX_SIZE - 1) {
+      valid = false;
+      break;
+    }
+    snprintf(output->path, sizeof(output->path), "%s", line + offset);
+  }
+
+  fclose(file);
+  return valid;
+}
+
+/**
+ * Counts the hit or the miss in the store's statistics
+ */
+static void count_lookup(const char *store, bool is_hit) {
+  char path[PATH_MAX], text[64] = "";
+  long long hits = 0, misses = 0;
+  ssize_t length;
+  int fd;
+
+  snprintf(path, sizeof(path), "%s/stats", store);
+  if ((fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) == -1)
+    return;
+
+  // Other shells may be counting at the same time
+  flock(fd, LOCK_EX);
+  if ((length = pread(fd, text, sizeof(text) - 1, 0)) > 0)
+    text[length] = '\0';
+  sscanf(text, "hits %lld misses %lld", &hits, &misses);
+  if (is_hit)
+    hits++;
+  else
+    misses++;
+
+  length = snprintf(text, sizeof(text), "hits %lld misses %lld\n", hits, misses);
+  if (pwrite(fd, text, length, 0) == length)
+    ftruncate(fd, length);
+  close(fd);
+}
+
+/**
+ * Passes the stored output on: straight from the blob to the descriptor,
+ * or through a mapping of the blob to the context's output callback
+ */
+static bool replay_stream(lsh_ctx *ctx, int stream, int blob_fd, long long size) {
+  void *data;
+
+  if (size == 0)
+    return true;
+
+  if (ctx->output_callback != NULL) {
+    if ((data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, blob_fd, 0)) == MAP_FAILED)
+      return false;
+    ctx->output_callback(ctx, stream, data, size, ctx->output_user_data);
+    munmap(data, size);
+    return true;
+  }
+
+  return copy_file(blob_fd, ctx->stdio[stream], size);
+}
+
+/**
+ * Replays the entry. Returns false, if any of its' blobs is missing.
+ */
+static bool replay_entry(lsh_ctx *ctx, const char *store, cache_entry *entry) {
+  int blob_fds[MAX_OUTPUTS_PER_ENTRY], directory_fd, target_fd, i;
+  cache_output *output;
+  char path[PATH_MAX];
+  struct stat info;
+  bool replayed = true;
+
+  // Open every blob first, so that nothing is replayed if the eviction removed any of them
+  for (i = 0; i < entry->output_count; i++) {
+    snprintf(path, sizeof(path), "%s/blobs/%s", store, entry->outputs[i].hash);
+    if ((blob_fds[i] = open(path, O_RDONLY | O_CLOEXEC)) == -1 || fstat(blob_fds[i], &info) == -1 || info.st_size != entry->outputs[i].size) {
+      if (blob_fds[i] != -1)
+        i++;
+      while (i-- > 0)
+        close(blob_fds[i]);
+      return false;
+    }
+  }
+
+  directory_fd = open(ctx->cwd, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  for (i = 0; i < entry->output_count; i++) {
+    output = &entry->outputs[i];
+
+    if (strcmp(output->kind, "stdout") == 0) {
+      replayed = replay_stream(ctx, LSH_STDOUT, blob_fds[i], output->size) && replayed;
+    }
+    else if (strcmp(output->kind, "stderr") == 0) {
+      replayed = replay_stream(ctx, LSH_STDERR, blob_fds[i], output->size) && replayed;
+    }
+    else if ((target_fd = openat(directory_fd, output->path, O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0600)) != -1) {
+      replayed = copy_file(blob_fds[i], target_fd, output->size) && replayed;
+      close(target_fd);
+    }
+    else {
+      lsh_printf(ctx, LSH_STDERR, "lsh: %s: %s\n", output->path, strerror(errno));
+    }
+    close(blob_fds[i]);
+  }
+
+  if (directory_fd != -1)
+    close(directory_fd);
+  if (!replayed)
+    lsh_printf(ctx, LSH_STDERR, "lsh: cache: unable to replay the whole output\n");
+  return true;
+}
+
+/**
+ * Creates a temporary file in the store
+ */
+static int create_temporary_file(const char *store, char path[PATH_MAX]) {
+  snprintf(path, PATH_MAX, "%s/tmp/XXXXXX", store);
+  return mkostemp(path, O_CLOEXEC);
+}
+
+/**
+ * Moves the recorded output into blobs/<hash>.
+ * An identical blob may already be there, then the new one is simply dropped.
+ */
+static bool store_blob(const char *store, const char *temporary_path, const char *hash) {
+  char path[PATH_MAX];
+
+  snprintf(path, sizeof(path), "%s/blobs/%s", store, hash);
+  if (access(path, F_OK) == 0) {
+    unlink(temporary_path);
+    return true;
+  }
+  if (rename(temporary_path, path) == -1) {
+    unlink(temporary_path);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Output callback recording the output of the command line, while passing it on
+ */
+static void record_output(lsh_ctx *ctx, int stream, const char *data, size_t length, void *user_data) {
+  cache_recorder *recorder = user_data;
+  cache_recording *recording = &recorder->streams[stream];
+
+  if (!recording->failed) {
+    recording->failed = !write_all(recording->fd, data, length);
+    sha256_update(&recording->hash, data, length);
+    recording->size += length;
+  }
+
+  if (recorder->callback != NULL)
+    recorder->callback(ctx, stream, data, length, recorder->user_data);
+  else
+    write_all(ctx->stdio[stream], data, length);
+}
+
+/**
+ * Copies the file the command line has written into the store
+ */
+static bool record_file(lsh_ctx *ctx, const char *store, int directory_fd, const char *name, cache_output *output) {
+  char temporary_path[PATH_MAX];
+  int source_fd, temporary_fd;
+  struct stat info;
+  sha256_ctx hash;
+  void *data;
+  bool recorded = false;
+
+  if ((source_fd = openat(directory_fd, name, O_RDONLY | O_CLOEXEC)) == -1)
+    return false;
+  if (fstat(source_fd, &info) == -1 || !S_ISREG(info.st_mode) || (temporary_fd = create_temporary_file(store, temporary_path)) == -1) {
+    close(source_fd);
+    return false;
+  }
+
+  sha256_init(&hash);
+  if (info.st_size > 0 && (data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, source_fd, 0)) != MAP_FAILED) {
+    sha256_update(&hash, data, info.st_size);
+    munmap(data, info.st_size);
+    recorded = copy_file(source_fd, temporary_fd, info.st_size);
+  }
+  else {
+    recorded = info.st_size == 0;
+  }
+  close(source_fd);
+  close(temporary_fd);
+
+  strcpy(output->kind, "file");
+  sha256_final_hex(&hash, output->hash);
+  output->size = info.st_size;
+  snprintf(output->path, sizeof(output->path), "%s", name);
+
+  if (!recorded) {
+    unlink(temporary_path);
+    return false;
+  }
+  return store_blob(store, temporary_path, output->hash);
+}
+
+/**
+ * Writes entries/<key> atomically
+ */
+static bool write_entry(const char *store, const char *key, cache_entry *entry) {
+  char temporary_path[PATH_MAX], path[PATH_MAX];
+  cache_output *output;
+  FILE *file;
+  int fd;
+  bool written;
+
+  if ((fd = create_temporary_file(store, temporary_path)) == -1)
+    return false;
+  if ((file = fdopen(fd, "w")) == NULL) {
+    close(fd);
+    unlink(temporary_path);
+    return false;
+  }
+
+  fprintf(file, CACHE_FORMAT "\nstatus %d\n", entry->status);
+  for (int i = 0; i < entry->output_count; i++) {
+    output = &entry->outputs[i];
+    fprintf(file, "%s %s %lld %s\n", output->kind, output->hash, output->size, output->path);
+  }
+  written = fclose(file) == 0;
+
+  snprintf(path, sizeof(path), "%s/entries/%s", store, key);
+  if (!written || rename(temporary_path, path) == -1) {
+    unlink(temporary_path);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Tells whether the command line didn't run to the end: any of its' commands was killed or stopped
+ * by a signal, the builtins were interrupted (their' status is 128 + the signal as well), or the deadline passed
+ */
+static bool was_cut_short(lsh_ctx *ctx, lsh_pipeline *pipeline, int status) {
+  int statuses[MAX_COMMANDS_PER_PIPELINE], count = lsh_pipeline_status(ctx, statuses, MAX_COMMANDS_PER_PIPELINE);
+  bool has_deadline = false;
+
+  for (int i = 0; i < count; i++) {
+    if (statuses[i] > 128)
+      return true;
+  }
+  for (int i = 0; i < pipeline->command_count; i++)
+    has_deadline = has_deadline || pipeline->commands[i].modifiers.has_deadline;
+  return status > 128 || (has_deadline && status == 124);
+}
+
+/**
+ * Runs the command line, recording its' outputs, and stores them under the key
+ */
+static int record_pipeline(lsh_ctx *ctx, lsh_pipeline *pipeline, const char *store, const char *key) {
+  static const char *stream_names[] = { "", "stdout", "stderr" };
+  cache_recorder recorder = { .callback = ctx->output_callback, .user_data = ctx->output_user_data };
+  cache_entry entry = { .output_count = 0 };
+  cache_output *output;
+  lsh_command *command;
+  bool complete = true;
+  int directory_fd, stream, i;
+
+  for (stream = LSH_STDOUT; stream <= LSH_STDERR; stream++) {
+    recorder.streams[stream].fd = create_temporary_file(store, recorder.streams[stream].path);
+    recorder.streams[stream].failed = recorder.streams[stream].fd == -1;
+    sha256_init(&recorder.streams[stream].hash);
+  }
+
+  // The output goes through record_output() on its' way to the usual destination
+  lsh_set_output_callback(ctx, record_output, &recorder);
+  entry.status = execute_pipeline(ctx, pipeline);
+  lsh_set_output_callback(ctx, recorder.callback, recorder.user_data);
+
+  for (stream = LSH_STDOUT; stream <= LSH_STDERR; stream++) {
+    cache_recording *recording = &recorder.streams[stream];
+
+    if (recording->fd == -1) {
+      complete = false;
+      continue;
+    }
+    close(recording->fd);
+
+    output = &entry.outputs[entry.output_count++];
+    strcpy(output->kind, stream_names[stream]);
+    sha256_final_hex(&recording->hash, output->hash);
+    output->size = recording->size;
+    output->path[0] = '\0';
+
+    if (recording->failed) {
+      unlink(recording->path);
+      complete = false;
+    }
+    else {
+      complete = store_blob(store, recording->path, output->hash) && complete;
+    }
+  }
+
+  // The files the commands have written to are a part of the output too
+  if ((directory_fd = open(ctx->cwd, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1)
+    complete = false;
+  for (i = 0; complete && i < pipeline->command_count; i++) {
+    command = &pipeline->commands[i];
+    if (command->output_file != NULL)
+      complete = record_file(ctx, store, directory_fd, command->output_file, &entry.outputs[entry.output_count++]);
+    if (complete && command->error_file != NULL)
+      complete = record_file(ctx, store, directory_fd, command->error_file, &entry.outputs[entry.output_count++]);
+  }
+  if (directory_fd != -1)
+    close(directory_fd);
+
+  // Incomplete recordings are never stored, the command line will simply run again next time.
+  // Neither are the ones cut short with Ctrl-C, Ctrl-Z or the deadline, which recorded only a part of the output.
+  if (complete && !was_cut_short(ctx, pipeline, entry.status))
+    write_entry(store, key, &entry);
+
+  return entry.status;
+}
+
+/**
+ * Checks if the command line starts with the 'cache' prefix, eg. cache sort big.csv | uniq -c > out
+ */
+bool is_cached_pipeline(lsh_pipeline *pipeline) {
+  lsh_command *command = &pipeline->commands[0];
+
+  if (strcmp(command->argv[0], "cache") != 0 || command->argc < 2)
+    return false;
+
+  // 'cache stats' and the like are run by the builtin itself
+  return pipeline->command_count > 1 || (strcmp(command->argv[1], "stats") != 0 && strcmp(command->argv[1], "evict") != 0 && strcmp(command->argv[1], "clear") != 0);
+}
+
+/**
+ * Tells whether the command line reads an input the key doesn't cover: the shell's standard input,
+ * unless it's the terminal or /dev/null, eg. printf 'b\na\n' | cache sort
+ */
+static bool reads_unkeyed_input(lsh_ctx *ctx, lsh_pipeline *pipeline) {
+  int input_fd = standard_stream(ctx, 0);
+  struct stat input, null_device;
+
+  if (pipeline->commands[0].input_file != NULL || isatty(input_fd))
+    return false;
+  if (fstat(input_fd, &input) == -1 || stat("/dev/null", &null_device) == -1)
+    return true;
+  return !S_ISCHR(input.st_mode) || input.st_rdev != null_device.st_rdev;
+}
+
+/**
+ * Returns the first of the commands run by a built-in function which changes the context,
+ * eg. cd or exit, or NULL if there's none. Replaying the output wouldn't repeat the change.
+ */
+static const char *find_context_builtin(lsh_pipeline *pipeline) {
+  lsh_command *command;
+
+  for (int i = 0; i < pipeline->command_count; i++) {
+    command = &pipeline->commands[i];
+    if (strcmp(command->argv[0], "exec") == 0)
+      return command->argv[0];
+    if (find_builtin_function(command->argv, pipeline->command_count > 1) != NULL && !is_thread_safe_builtin(command->argv[0]))
+      return command->argv[0];
+  }
+  return NULL;
+}
+
+/**
+ * Replays the command line from the cache, or runs and records it
+ */
+int execute_cached_pipeline(lsh_ctx *ctx, lsh_pipeline *pipeline) {
+  char store[PATH_MAX], key[SHA256_HEX_SIZE], path[PATH_MAX + 80];
+  cache_entry entry;
+  const char *builtin;
+  bool redirected;
+
+  // Drop the 'cache' prefix
+  pipeline->commands[0].argv++;
+  pipeline->commands[0].argc--;
+
+  if (pipeline->is_background) {
+    lsh_printf(ctx, LSH_STDERR, "lsh: cache: background commands cannot be cached\n");
+    return 1;
+  }
+
+  if ((builtin = find_context_builtin(pipeline)) != NULL) {
+    lsh_printf(ctx, LSH_STDERR, "lsh: cache: %s changes the state of the shell, the command will not be cached\n", builtin);
+    return execute_pipeline(ctx, pipeline);
+  }
+
+  // Numbered redirections and the streams kept with 'exec' bypass the recorded output
+  redirected = ctx->persistent_fds[LSH_STDOUT] != -1 || ctx->persistent_fds[LSH_STDERR] != -1;
+  for (int i = 0; i < pipeline->command_count; i++)
+    redirected = redirected || pipeline->commands[i].redirection_count > 0;
+  if (redirected) {
+    lsh_printf(ctx, LSH_STDERR, "lsh: cache: descriptor redirections cannot be cached, the command will not be cached\n");
+    return execute_pipeline(ctx, pipeline);
+  }
+
+  if (reads_unkeyed_input(ctx, pipeline)) {
+    lsh_printf(ctx, LSH_STDERR, "lsh: cache: the standard input is not redirected from a file with <, the command will not be cached\n");
+    return execute_pipeline(ctx, pipeline);
+  }
+
+  if (!find_store(ctx, store)) {
+    lsh_printf(ctx, LSH_STDERR, "lsh: cache: unable to create the store, the command will not be cached\n");
+    return execute_pipeline(ctx, pipeline);
+  }
+
+  compute_key(ctx, pipeline, key);
+  snprintf(path, sizeof(path), "%s/entries/%s", store, key);
+
+  if (read_entry(path, &entry) && replay_entry(ctx, store, &entry)) {
+    // Mark the entry as recently used, the eviction removes the least recently used ones first
+    utimensat(AT_FDCWD, path, NULL, 0);
+    count_lookup(store, true);
+    return entry.status;
+  }
+
+  count_lookup(store, false);
+  return record_pipeline(ctx, pipeline, store, key);
+}
+
+/*
+ * Entry as seen by the eviction
+ */
+typedef struct cache_entry_usage {
+  char key[SHA256_HEX_SIZE];
+  time_t last_used;
+  long long size;
+} cache_entry_usage;
+
+static int compare_last_used(const void *first, const void *second) {
+  const cache_entry_usage *a = first, *b = second;
+
+  return (a->last_used > b->last_used) - (a->last_used < b->last_used);
+}
+
+/**
+ * Parses the number with an optional suffix, eg. 100M with the K/M/G units, or 7d with s/m/h/d
+ */
+static bool parse_amount(const char *text, const char *suffixes, const long long *multipliers, long long *amount) {
+  char *end;
+  const char *suffix;
+
+  if (*text < '0' || *text > '9')
+    return false;
+  *amount = strtoll(text, &end, 10);
+  if (*end == '\0')
+    return true;
+  if (end[1] != '\0' || (suffix = strchr(suffixes, *end)) == NULL)
+    return false;
+  *amount *= multipliers[suffix - suffixes];
+  return true;
+}
+
+/**
+ * Removes the entries older than max_age seconds, then the least recently used ones,
+ * until the store fits in max_size bytes. Removes the blobs no entry refers to afterwards.
+ * Negative limits are not applied.
+ */
+static void evict(lsh_ctx *ctx, const char *store, long long max_size, long long max_age) {
+  cache_entry_usage *usages = NULL, *grown;
+  int count = 0, capacity = 0, removed = 0, kept, i, j;
+  long long total_size = 0;
+  char path[PATH_MAX + 320];
+  char (*referenced)[SHA256_HEX_SIZE] = NULL;
+  int referenced_count = 0;
+  cache_entry entry;
+  struct dirent *file;
+  struct stat info;
+  time_t now = time(NULL);
+  DIR *directory;
+  bool is_used;
+
+  // Collect the entries with their sizes
+  snprintf(path, sizeof(path), "%s/entries", store);
+  if ((directory = opendir(path)) == NULL)
+    return;
+  while ((file = readdir(directory)) != NULL) {
+    if (file->d_name[0] == '.' || strlen(file->d_name) != SHA256_HEX_SIZE - 1)
+      continue;
+    snprintf(path, sizeof(path), "%s/entries/%s", store, file->d_name);
+    if (stat(path, &info) == -1)
+      continue;
+
+    if (count == capacity) {
+      capacity = capacity ? capacity * 2 : 64;
+      if ((grown = realloc(usages, capacity * sizeof(*usages))) == NULL)
+        break;
+      usages = grown;
+    }
+    strcpy(usages[count].key, file->d_name);
+    usages[count].last_used = info.st_mtime;
+    usages[count].size = info.st_size;
+    if (read_entry(path, &entry)) {
+      for (i = 0; i < entry.output_count; i++)
+        usages[count].size += entry.outputs[i].size;
+    }
+    total_size += usages[count].size;
+    count++;
+  }
+  closedir(directory);
+
+  // Least recently used go first
+  qsort(usages, count, sizeof(*usages), compare_last_used);
+  for (i = 0; i < count; i++) {
+    if ((max_age < 0 || now - usages[i].last_used <= max_age) && (max_size < 0 || total_size <= max_size))
+      break;
+    snprintf(path, sizeof(path), "%s/entries/%s", store, usages[i].key);
+    unlink(path);
+    total_size -= usages[i].size;
+    removed++;
+  }
+
+  // Remember the blobs of the entries which are kept
+  kept = count - removed;
+  if (kept > 0 && (referenced = malloc((size_t) kept * MAX_OUTPUTS_PER_ENTRY * sizeof(*referenced))) == NULL) {
+    free(usages);
+    return;
+  }
+  for (i = removed; i < count; i++) {
+    snprintf(path, sizeof(path), "%s/entries/%s", store, usages[i].key);
+    if (read_entry(path, &entry)) {
+      for (j = 0; j < entry.output_count; j++)
+        strcpy(referenced[referenced_count++], entry.outputs[j].hash);
+    }
+  }
+
+  // Remove the blobs nobody refers to
+  snprintf(path, sizeof(path), "%s/blobs", store);
+  if ((directory = opendir(path)) != NULL) {
+    while ((file = readdir(directory)) != NULL) {
+      if (file->d_name[0] == '.')
+        continue;
+      is_used = false;
+      for (i = 0; i < referenced_count && !is_used; i++)
+        is_used = strcmp(referenced[i], file->d_name) == 0;
+      if (!is_used) {
+        snprintf(path, sizeof(path), "%s/blobs/%s", store, file->d_name);
+        unlink(path);
+      }
+    }
+    closedir(directory);
+  }
+
+  // Clean up after the shells which crashed while recording
+  snprintf(path, sizeof(path), "%s/tmp", store);
+  if ((directory = opendir(path)) != NULL) {
+    while ((file = readdir(directory)) != NULL) {
+      snprintf(path, sizeof(path), "%s/tmp/%s", store, file->d_name);
+      if (file->d_name[0] != '.' && stat(path, &info) == 0 && now - info.st_mtime > STALE_TEMPORARY_FILE_AGE)
+        unlink(path);
+    }
+    closedir(directory);
+  }
+
+  lsh_printf(ctx, LSH_STDOUT, "cache: removed %d of %d entries\n", removed, count);
+  free(referenced);
+  free(usages);
+}
+
+/**
+ * Prints the size of the store and how often it's hit
+ */
+static void show_statistics(lsh_ctx *ctx, const char *store) {
+  char path[PATH_MAX + 320], text[64] = "";
+  long long hits = 0, misses = 0, blob_bytes = 0;
+  int entries = 0, blobs = 0, fd;
+  struct dirent *file;
+  struct stat info;
+  ssize_t length;
+  DIR *directory;
+
+  snprintf(path, sizeof(path), "%s/entries", store);
+  if ((directory = opendir(path)) != NULL) {
+    while ((file = readdir(directory)) != NULL)
+      entries += file->d_name[0] != '.';
+    closedir(directory);
+  }
+
+  snprintf(path, sizeof(path), "%s/blobs", store);
+  if ((directory = opendir(path)) != NULL) {
+    while ((file = readdir(directory)) != NULL) {
+      snprintf(path, sizeof(path), "%s/blobs/%s", store, file->d_name);
+      if (file->d_name[0] != '.' && stat(path, &info) == 0) {
+        blobs++;
+        blob_bytes += info.st_size;
+      }
+    }
+    closedir(directory);
+  }
+
+  snprintf(path, sizeof(path), "%s/stats", store);
+  if ((fd = open(path, O_RDONLY | O_CLOEXEC)) != -1) {
+    if ((length = read(fd, text, sizeof(text) - 1)) > 0)
+      text[length] = '\0';
+    sscanf(text, "hits %lld misses %lld", &hits, &misses);
+    close(fd);
+  }
+
+  lsh_printf(ctx, LSH_STDOUT, "store:   %s\n", store);
+  lsh_printf(ctx, LSH_STDOUT, "entries: %d\n", entries);
+  lsh_printf(ctx, LSH_STDOUT, "blobs:   %d (%lld bytes)\n", blobs, blob_bytes);
+  lsh_printf(ctx, LSH_STDOUT, "hits:    %lld\n", hits);
+  lsh_printf(ctx, LSH_STDOUT, "misses:  %lld\n", misses);
+  if (hits + misses > 0)
+    lsh_printf(ctx, LSH_STDOUT, "ratio:   %.1f%%\n", 100.0 * hits / (hits + misses));
+}
+
+/*
+ * cache
+ * Manages the store of the command cache
+ */
+int cache_command(lsh_ctx *ctx, char *args[]) {
+  static const long long size_units[] = { 1024, 1024 * 1024, 1024 * 1024 * 1024 };
+  static const long long time_units[] = { 1, 60, 3600, 86400 };
+  long long max_size = -1, max_age = -1;
+  char store[PATH_MAX];
+  int i;
+
+  if (args[1] == NULL) {
+    lsh_printf(ctx, LSH_STDERR, "usage: cache COMMAND... | cache stats | cache evict [--max-size SIZE] [--max-age AGE] | cache clear\n");
+    return 2;
+  }
+
+  if (!find_store(ctx, store)) {
+    lsh_printf(ctx, LSH_STDERR, "lsh: cache: unable to create the store\n");
+    return 1;
+  }
+
+  if (strcmp(args[1], "stats") == 0) {
+    show_statistics(ctx, store);
+    return 0;
+  }
+
+  if (strcmp(args[1], "clear") == 0) {
+    evict(ctx, store, 0, -1);
+    return 0;
+  }
+
+  if (strcmp(args[1], "evict") == 0) {
+    for (i = 2; args[i] != NULL; i += 2) {
+      if (strcmp(args[i], "--max-size") == 0 && args[i + 1] != NULL && parse_amount(args[i + 1], "KMG", size_units, &max_size))
+        continue;
+      if (strcmp(args[i], "--max-age") == 0 && args[i + 1] != NULL && parse_amount(args[i + 1], "smhd", time_units, &max_age))
+        continue;
+      lsh_printf(ctx, LSH_STDERR, "usage: cache evict [--max-size SIZE[K|M|G]] [--max-age AGE[s|m|h|d]]\n");
+      return 2;
+    }
+    evict(ctx, store, max_size, max_age);
+    return 0;
+  }
+
+  lsh_printf(ctx, LSH_STDERR, "lsh: cache: unknown command %s\n", args[1]);
+  return 2;
+}
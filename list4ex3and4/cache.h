@@ -0,0 +1,21 @@
+/*
+ * cache.h
+ * Command result cache: 'cache CMD...' replays the recorded output of a command line
+ * instead of running it again, as long as nothing it depends on has changed
+ */
+
+#ifndef LSH_CACHE_H
+#define LSH_CACHE_H
+
+#include <stdbool.h>
+
+#include "context.h"
+#include "parser.h"
+
+bool is_cached_pipeline(lsh_pipeline *pipeline);
+int execute_cached_pipeline(lsh_ctx *ctx, lsh_pipeline *pipeline);
+
+// The 'cache' builtin: cache stats, cache evict [--max-size SIZE] [--max-age AGE], cache clear
+int cache_command(lsh_ctx *ctx, char *args[]);
+
+#endif
@@ -0,0 +1,450 @@
+/*
+ * config.c
+ * Startup configuration (~/.lshrc) and its' precompiled snapshot
+ *
+ * Syntax of the rc file, one definition per line:
+ *   # comment
+ *   alias ll=ls -l
+ *   function count sort $@ | uniq -c
+ *   export EDITOR=vi
+ *   prompt %u@%h %d >
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "config.h"
+
+#define MAX_CONFIG_SIZE (16 * 1024 * 1024) // Larger rc files are refused
+
+/*
+ * Image of the configuration being built from the rc file
+ */
+typedef struct config_builder {
+  config_record *records[CONFIG_KINDS];
+  uint32_t counts[CONFIG_KINDS];
+  uint32_t capacities[CONFIG_KINDS];
+  char *strings;
+  size_t strings_size;
+  size_t strings_capacity;
+  uint32_t prompt;
+  bool failed; // Out of memory
+} config_builder;
+
+static const char *kind_names[CONFIG_KINDS] = { "alias", "function", "export" };
+
+/**
+ * Returns the records of the given kind in the image
+ */
+static const config_record *image_records(const char *image, int kind) {
+  const config_header *header = (const config_header *) image;
+  const config_record *records = (const config_record *) (image + sizeof(config_header));
+
+  for (int i = 0; i < kind; i++)
+    records += header->counts[i];
+  return records;
+}
+
+/**
+ * Looks the name up among the definitions of the given kind.
+ * Returns NULL if the context has no such definition.
+ */
+const char *config_lookup(lsh_ctx *ctx, int kind, const char *name) {
+  const config_header *header = (const config_header *) ctx->config;
+  const config_record *records;
+  const char *strings;
+
+  if (header == NULL)
+    return NULL;
+
+  records = image_records(ctx->config, kind);
+  strings = ctx->config + header->strings;
+  for (uint32_t i = 0; i < header->counts[kind]; i++) {
+    if (strcmp(strings + records[i].name, name) == 0)
+      return strings + records[i].value;
+  }
+  return NULL;
+}
+
+/**
+ * Drops the configuration of the context
+ */
+void config_release(lsh_ctx *ctx) {
+  if (ctx->config == NULL)
+    return;
+
+  if (ctx->config_is_mapped)
+    munmap((void *) ctx->config, ctx->config_size);
+  else
+    free((void *) ctx->config);
+  ctx->config = NULL;
+  ctx->config_size = 0;
+}
+
+/**
+ * Checks that every offset of the image points inside of it,
+ * so that a damaged snapshot can never be read past its' end
+ */
+static bool image_is_valid(const char *image, size_t size) {
+  const config_header *header = (const config_header *) image;
+  const config_record *records = (const config_record *) (image + sizeof(config_header));
+  uint64_t record_count = 0;
+
+  if (size < sizeof(config_header) || memcmp(header->magic, CONFIG_SNAPSHOT_MAGIC, 8) != 0 || header->image_size != size)
+    return false;
+
+  for (int i = 0; i < CONFIG_KINDS; i++)
+    record_count += header->counts[i];
+
+  // The string area has to come after the records and end with a terminator
+  if (header->strings < sizeof(config_header) + record_count * sizeof(config_record) || header->strings >= size || image[size - 1] != '\0')
+    return false;
+  if (header->prompt >= size - header->strings)
+    return false;
+
+  for (uint64_t i = 0; i < record_count; i++) {
+    if (records[i].name >= size - header->strings || records[i].value >= size - header->strings)
+      return false;
+  }
+  return true;
+}
+
+/**
+ * Copies the string into the string area of the image, returning its' offset
+ */
+static uint32_t add_string(config_builder *builder, const char *string, size_t length) {
+  size_t offset = builder->strings_size;
+  char *grown;
+
+  while (builder->strings_size + length + 1 > builder->strings_capacity) {
+    builder->strings_capacity = builder->strings_capacity ? builder->strings_capacity * 2 : 1024;
+    if ((grown = realloc(builder->strings, builder->strings_capacity)) == NULL) {
+      builder->failed = true;
+      return 0;
+    }
+    builder->strings = grown;
+  }
+
+  memcpy(builder->strings + offset, string, length);
+  builder->strings[offset + length] = '\0';
+  builder->strings_size += length + 1;
+  return offset;
+}
+
+/**
+ * Adds the definition, replacing the previous one with the same name
+ */
+static void add_record(config_builder *builder, int kind, const char *name, size_t name_length, const char *value, size_t value_length) {
+  config_record *grown;
+  uint32_t i;
+
+  for (i = 0; i < builder->counts[kind]; i++) {
+    if (strlen(builder->strings + builder->records[kind][i].name) == name_length && strncmp(builder->strings + builder->records[kind][i].name, name, name_length) == 0) {
+      builder->records[kind][i].value = add_string(builder, value, value_length);
+      return;
+    }
+  }
+
+  if (builder->counts[kind] == builder->capacities[kind]) {
+    builder->capacities[kind] = builder->capacities[kind] ? builder->capacities[kind] * 2 : 16;
+    if ((grown = realloc(builder->records[kind], builder->capacities[kind] * sizeof(config_record))) == NULL) {
+      builder->failed = true;
+      return;
+    }
+    builder->records[kind] = grown;
+  }
+
+  builder->records[kind][i].name = add_string(builder, name, name_length);
+  builder->records[kind][i].value = add_string(builder, value, value_length);
+  builder->counts[kind]++;
+}
+
+/**
+ * Parses a single line of the rc file
+ */
+static void parse_config_line(lsh_ctx *ctx, config_builder *builder, const char *path, int line_number, char *line) {
+  size_t keyword_length, name_length;
+  char *rest, *separator;
+  int kind;
+
+  line[strcspn(line, "\r\n")] = '\0';
+  line += strspn(line, " \t");
+  if (line[0] == '\0' || line[0] == '#')
+    return;
+
+  keyword_length = strcspn(line, " \t");
+  rest = line + keyword_length;
+  rest += strspn(rest, " \t");
+
+  // prompt FORMAT keeps the trailing whitespace of the format
+  if (keyword_length == 6 && strncmp(line, "prompt", 6) == 0) {
+    builder->prompt = add_string(builder, rest, strlen(rest));
+    return;
+  }
+
+  for (kind = 0; kind < CONFIG_KINDS; kind++) {
+    if (keyword_length == strlen(kind_names[kind]) && strncmp(line, kind_names[kind], keyword_length) == 0)
+      break;
+  }
+  if (kind == CONFIG_KINDS) {
+    lsh_printf(ctx, LSH_STDERR, "lsh: %s:%d: unknown definition %.*s\n", path, line_number, (int) keyword_length, line);
+    return;
+  }
+
+  // function NAME BODY, the other ones are NAME=VALUE
+  if (kind == CONFIG_FUNCTION) {
+    name_length = strcspn(rest, " \t");
+    separator = rest + name_length;
+    separator += strspn(separator, " \t");
+    if (name_length == 0 || *separator == '\0') {
+      lsh_printf(ctx, LSH_STDERR, "lsh: %s:%d: expected 'function NAME BODY'\n", path, line_number);
+      return;
+    }
+    add_record(builder, kind, rest, name_length, separator, strlen(separator));
+    return;
+  }
+
+  separator = strchr(rest, '=');
+  if (separator == NULL || separator == rest || strcspn(rest, " \t") < (size_t) (separator - rest)) {
+    lsh_printf(ctx, LSH_STDERR, "lsh: %s:%d: expected '%s NAME=VALUE'\n", path, line_number, kind_names[kind]);
+    return;
+  }
+  add_record(builder, kind, rest, separator - rest, separator + 1, strlen(separator + 1));
+}
+
+/**
+ * Lays the parsed configuration out as a single image
+ */
+static char *build_image(config_builder *builder, const struct stat *rc_info, const char *rc_hash, size_t *image_size) {
+  config_header *header;
+  size_t records_size = 0, offset;
+  char *image;
+
+  for (int i = 0; i < CONFIG_KINDS; i++)
+    records_size += builder->counts[i] * sizeof(config_record);
+
+  *image_size = sizeof(config_header) + records_size + builder->strings_size;
+  if (builder->failed || *image_size > UINT32_MAX || (image = calloc(1, *image_size)) == NULL)
+    return NULL;
+
+  header = (config_header *) image;
+  memcpy(header->magic, CONFIG_SNAPSHOT_MAGIC, 8);
+  header->image_size = *image_size;
+  header->prompt = builder->prompt;
+  header->strings = sizeof(config_header) + records_size;
+  header->rc_size = rc_info->st_size;
+  header->rc_mtime_sec = rc_info->st_mtim.tv_sec;
+  header->rc_mtime_nsec = rc_info->st_mtim.tv_nsec;
+  strcpy(header->rc_hash, rc_hash);
+
+  offset = sizeof(config_header);
+  for (int i = 0; i < CONFIG_KINDS; i++) {
+    header->counts[i] = builder->counts[i];
+    memcpy(image + offset, builder->records[i], builder->counts[i] * sizeof(config_record));
+    offset += builder->counts[i] * sizeof(config_record);
+  }
+  memcpy(image + offset, builder->strings, builder->strings_size);
+  return image;
+}
+
+/**
+ * Reads the whole rc file and hashes it
+ */
+static char *read_config_file(int fd, size_t size, char hash[SHA256_HEX_SIZE]) {
+  sha256_ctx hash_ctx;
+  char *content;
+  size_t done = 0;
+  ssize_t count;
+
+  if (size > MAX_CONFIG_SIZE || (content = malloc(size + 1)) == NULL)
+    return NULL;
+
+  while (done < size) {
+    if ((count = read(fd, content + done, size - done)) <= 0) {
+      if (count == -1 && errno == EINTR)
+        continue;
+      break;
+    }
+    done += count;
+  }
+  content[done] = '\0';
+
+  sha256_init(&hash_ctx);
+  sha256_update(&hash_ctx, content, done);
+  sha256_final_hex(&hash_ctx, hash);
+  return content;
+}
+
+/**
+ * Writes the snapshot next to the rc file. Failures are not reported:
+ * without the snapshot the next shell just parses the rc file again.
+ */
+static void write_snapshot(const char *snapshot_path, const char *image, size_t image_size) {
+  char temporary_path[PATH_MAX];
+  int fd;
+  bool written;
+
+  if (snprintf(temporary_path, sizeof(temporary_path), "%s.XXXXXX", snapshot_path) >= (int) sizeof(temporary_path))
+    return;
+  if ((fd = mkostemp(temporary_path, O_CLOEXEC)) == -1)
+    return;
+
+  written = write(fd, image, image_size) == (ssize_t) image_size;
+  if (close(fd) == -1 || !written || rename(temporary_path, snapshot_path) == -1)
+    unlink(temporary_path);
+}
+
+/**
+ * Maps the snapshot into memory. Returns NULL if it's missing or damaged.
+ */
+static const char *map_snapshot(const char *snapshot_path, size_t *size) {
+  struct stat info;
+  void *image;
+  int fd;
+
+  if ((fd = open(snapshot_path, O_RDONLY | O_CLOEXEC)) == -1)
+    return NULL;
+  if (fstat(fd, &info) == -1 || info.st_size < (off_t) sizeof(config_header) || info.st_size > MAX_CONFIG_SIZE * 4) {
+    close(fd);
+    return NULL;
+  }
+
+  image = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (image == MAP_FAILED)
+    return NULL;
+
+  if (!image_is_valid(image, info.st_size)) {
+    munmap(image, info.st_size);
+    return NULL;
+  }
+  *size = info.st_size;
+  return image;
+}
+
+/**
+ * Loads the rc file, from its' snapshot whenever the snapshot is up to date.
+ * The snapshot is trusted if the size and mtime of the rc file match,
+ * or else if the hash of its' content does (eg. after it was touched).
+ */
+int lsh_load_config(lsh_ctx *ctx, const char *path, lsh_config_info *info) {
+  char snapshot_path[PATH_MAX], rc_hash[SHA256_HEX_SIZE], *content, *line, *saveptr;
+  const config_header *header;
+  const config_record *variables;
+  config_builder builder;
+  struct stat rc_info;
+  size_t image_size = 0;
+  const char *image;
+  int fd, source, line_number = 0;
+
+  if (info != NULL)
+    memset(info, 0, sizeof(*info));
+
+  if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) {
+    if (errno == ENOENT)
+      return 0;
+    lsh_printf(ctx, LSH_STDERR, "lsh: %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  if (fstat(fd, &rc_info) == -1 || snprintf(snapshot_path, sizeof(snapshot_path), "%s" CONFIG_SNAPSHOT_SUFFIX, path) >= (int) sizeof(snapshot_path)) {
+    close(fd);
+    return -1;
+  }
+
+  config_release(ctx);
+
+  image = map_snapshot(snapshot_path, &image_size);
+  header = (const config_header *) image;
+  source = LSH_CONFIG_SNAPSHOT;
+
+  if (image == NULL || header->rc_size != rc_info.st_size || header->rc_mtime_sec != rc_info.st_mtim.tv_sec || header->rc_mtime_nsec != rc_info.st_mtim.tv_nsec) {
+    // The snapshot may be stale, so the rc file has to be read after all
+    if ((content = read_config_file(fd, rc_info.st_size, rc_hash)) == NULL) {
+      if (image != NULL)
+        munmap((void *) image, image_size);
+      close(fd);
+      lsh_printf(ctx, LSH_STDERR, "lsh: %s: unable to read the configuration\n", path);
+      return -1;
+    }
+
+    if (image != NULL && header->rc_size == rc_info.st_size && strcmp(header->rc_hash, rc_hash) == 0) {
+      // Same content with a new mtime: record the new state, so that the next shell takes the fast path
+      char *refreshed = malloc(image_size);
+
+      if (refreshed != NULL) {
+        memcpy(refreshed, image, image_size);
+        ((config_header *) refreshed)->rc_mtime_sec = rc_info.st_mtim.tv_sec;
+        ((config_header *) refreshed)->rc_mtime_nsec = rc_info.st_mtim.tv_nsec;
+        write_snapshot(snapshot_path, refreshed, image_size);
+        free(refreshed);
+      }
+    }
+    else {
+      if (image != NULL)
+        munmap((void *) image, image_size);
+      image = NULL;
+    }
+
+    if (image == NULL) {
+      // Parse the rc file and leave the snapshot for the next shells
+      memset(&builder, 0, sizeof(builder));
+      add_string(&builder, "", 0);
+      for (line = strtok_r(content, "\n", &saveptr); line != NULL; line = strtok_r(NULL, "\n", &saveptr))
+        parse_config_line(ctx, &builder, path, ++line_number, line);
+
+      image = build_image(&builder, &rc_info, rc_hash, &image_size);
+      for (int i = 0; i < CONFIG_KINDS; i++)
+        free(builder.records[i]);
+      free(builder.strings);
+
+      if (image == NULL) {
+        free(content);
+        close(fd);
+        lsh_printf(ctx, LSH_STDERR, "lsh: %s: allocation error\n", path);
+        return -1;
+      }
+      write_snapshot(snapshot_path, image, image_size);
+      source = LSH_CONFIG_PARSED;
+    }
+    free(content);
+  }
+  close(fd);
+
+  ctx->config = image;
+  ctx->config_size = image_size;
+  ctx->config_is_mapped = source == LSH_CONFIG_SNAPSHOT;
+  header = (const config_header *) image;
+
+  // The variables are copied into the context's environment
+  variables = image_records(image, CONFIG_VARIABLE);
+  for (uint32_t i = 0; i < header->counts[CONFIG_VARIABLE]; i++)
+    lsh_setenv(ctx, image + header->strings + variables[i].name, image + header->strings + variables[i].value);
+
+  if (info != NULL) {
+    info->source = source;
+    info->alias_count = header->counts[CONFIG_ALIAS];
+    info->function_count = header->counts[CONFIG_FUNCTION];
+    info->variable_count = header->counts[CONFIG_VARIABLE];
+  }
+  return 0;
+}
+
+/**
+ * Format of the prompt set in the configuration, or NULL
+ */
+const char *lsh_prompt(const lsh_ctx *ctx) {
+  const config_header *header = (const config_header *) ctx->config;
+
+  if (header == NULL || header->prompt == 0)
+    return NULL;
+  return ctx->config + header->strings + header->prompt;
+}
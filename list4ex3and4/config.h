@@ -0,0 +1,52 @@
+/*
+ * config.h
+ * Startup configuration (~/.lshrc) and its' precompiled snapshot
+ *
+ * The parsed configuration is kept as a single image: the header, the records
+ * and the strings they point to. The same image is written next to the rc file
+ * (~/.lshrc.snapshot) and mapped straight into memory by the following shells,
+ * as long as the rc file has not changed.
+ */
+
+#ifndef LSH_CONFIG_H
+#define LSH_CONFIG_H
+
+#include <stdint.h>
+
+#include "context.h"
+#include "sha256.h"
+
+// Definitions
+#define CONFIG_SNAPSHOT_MAGIC "LSHSNAP1"
+#define CONFIG_SNAPSHOT_SUFFIX ".snapshot"
+
+// Kinds of the records
+#define CONFIG_ALIAS 0 // alias NAME=TEXT
+#define CONFIG_FUNCTION 1 // function NAME BODY, with $1-$9 and $@ replaced by the arguments
+#define CONFIG_VARIABLE 2 // export NAME=VALUE
+#define CONFIG_KINDS 3
+
+typedef struct config_record {
+  uint32_t name; // Offsets in the string area
+  uint32_t value;
+} config_record;
+
+typedef struct config_header {
+  char magic[8];
+  uint32_t image_size;
+  uint32_t counts[CONFIG_KINDS]; // Records of each kind follow the header, in the order of the kinds
+  uint32_t prompt; // prompt FORMAT, 0 if not set
+  uint32_t strings; // Offset of the string area; its' first byte is an empty string
+
+  // State of the rc file the image was made from
+  int64_t rc_size;
+  int64_t rc_mtime_sec;
+  int64_t rc_mtime_nsec;
+  char rc_hash[SHA256_HEX_SIZE];
+} config_header;
+
+// Lookups in the configuration of the context
+const char *config_lookup(lsh_ctx *ctx, int kind, const char *name);
+void config_release(lsh_ctx *ctx);
+
+#endif
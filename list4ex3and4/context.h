@@ -0,0 +1,97 @@
+/*
+ * context.h
+ * State of a single lsh instance, shared by the library's internal modules
+ */
+
+#ifndef LSH_CONTEXT_H
+#define LSH_CONTEXT_H
+
+#include <limits.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <termios.h>
+#include <sys/types.h>
+
+#include "liblsh.h"
+#include "parser.h"
+
+// Definitions
+#define MAX_BACKGROUND_JOBS 4096 // Maximum number of background processes tracked at once
+
+struct lsh_ctx {
+  char cwd[PATH_MAX]; // Working directory the commands are started in
+  int status; // Exit status of the last command line
+  bool exit_requested;
+
+  // PID of the command the context is waiting for, and the process group of its' pipeline
+  volatile pid_t foreground_pid;
+  volatile pid_t foreground_group;
+
+  // Terminal handed over to the foreground pipelines, -1 if none, see lsh_set_terminal()
+  int terminal_fd;
+  struct termios terminal_modes;
+  bool has_terminal_modes;
+
+  // PIDs of the background processes which have not been reaped yet, 0 marks a free slot.
+  // Slots are only filled by lsh_eval() and only emptied by lsh_reap() or lsh_wait_background().
+  volatile pid_t background_jobs[MAX_BACKGROUND_JOBS];
+
+  // Standard input, output and error of the commands, indexed with 0/LSH_STDOUT/LSH_STDERR
+  int stdio[3];
+
+  // Variables set with lsh_setenv(), as NAME=value entries
+  char **environment;
+  int environment_count;
+
+  // Output capture
+  lsh_output_callback output_callback;
+  void *output_user_data;
+
+  // Descriptors the builtins use instead of the standard ones, -1 if not redirected.
+  // Indexed with 0/LSH_STDOUT/LSH_STDERR.
+  int builtin_fds[3];
+
+  // Descriptors kept open with 'exec', by the number the commands know them under, -1 if none.
+  // The ones of the standard streams take the place of stdio[], see descriptors.h.
+  int persistent_fds[MAX_REDIRECTED_FD + 1];
+
+  // Built-in functions running in the shell's process (on its' main thread or as stages of the pipeline)
+  // are out of reach of the signals, so lsh_interrupt() sets the signal they stop for instead.
+  // interrupt_fd is an eventfd which becomes readable at the same time, to wake up blocked reads.
+  volatile sig_atomic_t builtins_running;
+  volatile sig_atomic_t interrupt_signal;
+  int interrupt_fd;
+
+  // The owner's reference, and one for each of the stage threads. The threads of a stopped pipeline
+  // may still be running after lsh_ctx_free(), so the last of them frees the context.
+  atomic_int references;
+
+  // Exit statuses of the commands of the last pipeline, see lsh_pipeline_status()
+  int stage_statuses[MAX_COMMANDS_PER_PIPELINE];
+  int stage_count;
+
+  // Image of the configuration loaded with lsh_load_config(), see config.h
+  const char *config;
+  size_t config_size;
+  bool config_is_mapped; // Mapped from the snapshot rather than allocated
+};
+
+// Drops a reference to the context, the last one frees it
+void lsh_ctx_release(lsh_ctx *ctx);
+
+// Value of the variable, looked up in the context first
+const char *lsh_getenv(lsh_ctx *ctx, const char *name);
+
+// Descriptors of the builtin run on the current thread as a stage of a pipeline, -1 otherwise.
+// They take precedence over the context's own ones.
+extern __thread int lsh_stage_fds[3];
+
+// Input of the builtins
+int lsh_input_fd(lsh_ctx *ctx);
+
+// Output of the builtins and the shell's own messages. lsh_write() returns -1 if the output is gone.
+int lsh_write(lsh_ctx *ctx, int stream, const char *data, size_t length);
+void lsh_printf(lsh_ctx *ctx, int stream, const char *format, ...) __attribute__((format(printf, 3, 4)));
+
+#endif
@@ -3,7 +3,17 @@
  * Configure the built-in shell functions
  */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
 #include "default_functions.h"
+#include "cache.h"
 
 
 /*
@@ -12,38 +22,147 @@
 char *builtin_str[] = {
   "cd",
   "help",
-  "exit"
+  "exit",
+  "cache",
+  "echo",
+  "cat",
+  "tee"
 };
 
 // Array of function pointers
-int (*builtin_func[]) (char *[]) = {
+lsh_builtin builtin_func[] = {
   &change_directory,
   &show_help,
-  &exit_shell
+  &exit_shell,
+  &cache_command,
+  &echo_arguments,
+  &concatenate_files,
+  &tee_input
+};
+
+// Built-in functions which only read their input and write their output, so they can run
+// on a thread of the shell as a stage of a pipeline (see executor.c), instead of a child process
+static const char *thread_safe_builtins[] = {
+  "help",
+  "echo",
+  "cat",
+  "tee"
+};
+
+// Built-in versions of programs, used only as stages of a pipeline; the standalone commands run the programs
+static const char *stage_builtins[] = {
+  "echo",
+  "cat",
+  "tee"
+};
+
+// Built-in functions which read the standard input
+static const char *reading_builtins[] = {
+  "cat",
+  "tee"
 };
 
+#define STREAM_BUFFER_SIZE 65536
+
 int number_of_builtin_functions() {
   return sizeof(builtin_str) / sizeof(char *);
 }
 
+/*
+ * Tells whether the built-in function leaves the context alone
+ */
+bool is_thread_safe_builtin(const char *name) {
+  for (size_t i = 0; i < sizeof(thread_safe_builtins) / sizeof(char *); i++) {
+    if (strcmp(name, thread_safe_builtins[i]) == 0)
+      return true;
+  }
+  return false;
+}
+
+/*
+ * Tells whether the built-in function may read the standard input
+ */
+bool builtin_reads_input(const char *name) {
+  for (size_t i = 0; i < sizeof(reading_builtins) / sizeof(char *); i++) {
+    if (strcmp(name, reading_builtins[i]) == 0)
+      return true;
+  }
+  return false;
+}
+
+/*
+ * Tells whether the built-in version of echo, cat or tee understands all of the options.
+ * Only echo -n, tee -a and cat - are supported, anything else is left to the real program.
+ */
+static bool supports_options(char *args[]) {
+  int i = 1;
+
+  // echo and tee only take the options in front of the other arguments, and echo prints the rest as they are
+  if ((strcmp(args[0], "echo") == 0 && args[1] != NULL && strcmp(args[1], "-n") == 0)
+      || (strcmp(args[0], "tee") == 0 && args[1] != NULL && strcmp(args[1], "-a") == 0))
+    i = 2;
+  if (strcmp(args[0], "echo") == 0)
+    return args[i] == NULL || args[i][0] != '-' || args[i][1] == '\0';
+
+  for (; args[i] != NULL; i++) {
+    if (args[i][0] == '-' && args[i][1] != '\0')
+      return false;
+  }
+  return true;
+}
+
+static bool is_stage_builtin(const char *name) {
+  for (size_t i = 0; i < sizeof(stage_builtins) / sizeof(char *); i++) {
+    if (strcmp(name, stage_builtins[i]) == 0)
+      return true;
+  }
+  return false;
+}
+
+/*
+ * Returns the built-in function which runs the command, or NULL if there's none.
+ * is_stage tells whether the command is a part of a pipeline of more than one command.
+ */
+lsh_builtin find_builtin_function(char *args[], bool is_stage) {
+  if (is_stage_builtin(args[0]) && (!is_stage || !supports_options(args)))
+    return NULL;
+  for (int i = 0; i < number_of_builtin_functions(); i++) {
+    if (strcmp(args[0], builtin_str[i]) == 0)
+      return builtin_func[i];
+  }
+  return NULL;
+}
+
 /*
  * cd
- * Change the directory
+ * Change the directory of the context.
+ * The process' own working directory is left alone, so that every context can have its' own.
  */
-int change_directory(char* args[]) {
+int change_directory(lsh_ctx *ctx, char *args[]) {
+  char path[PATH_MAX], resolved[PATH_MAX];
+  struct stat info;
+  const char *target = args[1];
+  int length;
 
-  if (args[1] == NULL) {
+  if (target == NULL) {
     // If no path is provided after the call to the function, go to home directory
-  	chdir(getenv("HOME"));
-  	return 1;
+    if ((target = getenv("HOME")) == NULL)
+      return 1;
   }
-  else {
-    // Change to the directory provided by the user
-  	if (chdir(args[1]) == -1) { // Handles the situation when desired directory is nonexistant
-  		printf("%s: directory does not exist\n", args[1]);
-      return -1;
-  	}
+
+  // Relative paths are resolved against the context's directory
+  if (target[0] == '/')
+    length = snprintf(path, sizeof(path), "%s", target);
+  else
+    length = snprintf(path, sizeof(path), "%s/%s", ctx->cwd, target);
+
+  // Handles the situation when desired directory is nonexistant
+  if (length >= (int) sizeof(path) || realpath(path, resolved) == NULL || stat(resolved, &info) == -1 || !S_ISDIR(info.st_mode)) {
+    lsh_printf(ctx, LSH_STDERR, "%s: directory does not exist\n", target);
+    return 1;
   }
+
+  strcpy(ctx->cwd, resolved);
   return 0;
 }
 
@@ -51,24 +170,170 @@ int change_directory(char* args[]) {
  * help
  * Presents the user with the short help manual for lsh
  */
-int show_help(char *args[]) {
+int show_help(lsh_ctx *ctx, char *args[]) {
   int i;
-  printf("This is lsh - a bash implementation in C\n");
-  printf("\nTo run the command:\n- Type the name of the command\n- Type the arguments needed to run the command\n- Hit the return key\n");
-  printf("\nYou can also use the built-in commands from the list below:\n");
+  lsh_printf(ctx, LSH_STDOUT, "This is lsh - a bash implementation in C\n");
+  lsh_printf(ctx, LSH_STDOUT, "\nTo run the command:\n- Type the name of the command\n- Type the arguments needed to run the command\n- Hit the return key\n");
+  lsh_printf(ctx, LSH_STDOUT, "\nYou can also use the built-in commands from the list below:\n");
 
   for (i = 0; i < number_of_builtin_functions(); i++) {
-    printf("- %s\n", builtin_str[i]);
+    lsh_printf(ctx, LSH_STDOUT, "- %s%s\n", builtin_str[i], is_stage_builtin(builtin_str[i]) ? " (only as a stage of a pipeline)" : "");
   }
+  lsh_printf(ctx, LSH_STDOUT, "- exec REDIRECTION... (keeps the descriptors open for the following commands, eg. exec 3>>log)\n");
+  lsh_printf(ctx, LSH_STDOUT, "- timeout DURATION COMMAND... (stops the whole pipeline once the duration passes)\n");
 
-  printf("\nIn order to get more support about specific commands,\ntype man and the name of the command, eg. man rm\n");
-  return 1;
+  lsh_printf(ctx, LSH_STDOUT, "\nIn order to get more support about specific commands,\ntype man and the name of the command, eg. man rm\n");
+  return 0;
 }
 
 /*
  * exit
- * Quits the shell
+ * Quits the shell, optionally with the given exit status
+ */
+int exit_shell(lsh_ctx *ctx, char *args[]) {
+  ctx->exit_requested = true;
+  return args[1] != NULL ? atoi(args[1]) : 0;
+}
+
+/*
+ * echo
+ * Prints the arguments separated with spaces; -n leaves out the newline
+ */
+int echo_arguments(lsh_ctx *ctx, char *args[]) {
+  bool newline = args[1] == NULL || strcmp(args[1], "-n") != 0;
+  size_t length = 0, capacity = 1;
+  char *line;
+  int i, status;
+
+  for (i = newline ? 1 : 2; args[i] != NULL; i++)
+    capacity += strlen(args[i]) + 1;
+  if ((line = malloc(capacity)) == NULL)
+    return 1;
+
+  // The line is written at once, so that it can't be interleaved with the other stages' output
+  for (i = newline ? 1 : 2; args[i] != NULL; i++) {
+    if (length > 0)
+      line[length++] = ' ';
+    strcpy(line + length, args[i]);
+    length += strlen(args[i]);
+  }
+  if (newline)
+    line[length++] = '\n';
+
+  status = lsh_write(ctx, LSH_STDOUT, line, length) == -1;
+  free(line);
+  return status;
+}
+
+/**
+ * Opens the file relative to the context's directory
+ */
+static int open_in_context(lsh_ctx *ctx, const char *file, int flags) {
+  char path[PATH_MAX];
+
+  if (file[0] != '/' && snprintf(path, sizeof(path), "%s/%s", ctx->cwd, file) < (int) sizeof(path))
+    file = path;
+  return open(file, flags | O_CLOEXEC, 0600);
+}
+
+/**
+ * Copies everything from the descriptor to the output of the builtin, and to the copies
+ * (the ones which can't be written to anymore are closed and set to -1).
+ * Returns 0, 1 if the descriptor can't be read, 2 if the output is gone (eg. the reader quit)
+ * or 3 if the builtin was interrupted, see lsh_interrupt().
+ */
+static int copy_stream(lsh_ctx *ctx, int fd, int copies[], int copy_count) {
+  struct pollfd fds[] = { { .fd = fd, .events = POLLIN }, { .fd = ctx->interrupt_fd, .events = POLLIN } };
+  char buffer[STREAM_BUFFER_SIZE];
+  ssize_t length;
+
+  while (true) {
+    // No signal reaches the builtins run by the shell, so a blocked read waits for the interruption as well
+    if (poll(fds, 2, -1) == -1 && errno != EINTR)
+      return 1;
+    if (ctx->interrupt_signal != 0)
+      return 3;
+    if ((length = read(fd, buffer, sizeof(buffer))) == 0)
+      break;
+    if (length == -1) {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+      return 1;
+    }
+
+    if (lsh_write(ctx, LSH_STDOUT, buffer, length) == -1)
+      return 2;
+    for (int i = 0; i < copy_count; i++) {
+      if (copies[i] != -1 && write(copies[i], buffer, length) != length) {
+        close(copies[i]);
+        copies[i] = -1;
+      }
+    }
+  }
+  return 0;
+}
+
+/*
+ * cat
+ * Prints the files, or the standard input if there are none ('-' also stands for it)
  */
-int exit_shell(char *args[]) {
-  exit(0);
+int concatenate_files(lsh_ctx *ctx, char *args[]) {
+  int status = 0, fd, result;
+
+  if (args[1] == NULL) {
+    result = copy_stream(ctx, lsh_input_fd(ctx), NULL, 0);
+    return result == 3 ? 128 + ctx->interrupt_signal : result != 0;
+  }
+
+  for (int i = 1; args[i] != NULL; i++) {
+    if (strcmp(args[i], "-") == 0) {
+      fd = lsh_input_fd(ctx);
+    }
+    else if ((fd = open_in_context(ctx, args[i], O_RDONLY)) == -1) {
+      lsh_printf(ctx, LSH_STDERR, "cat: %s: %s\n", args[i], strerror(errno));
+      status = 1;
+      continue;
+    }
+
+    result = copy_stream(ctx, fd, NULL, 0);
+    if (fd != lsh_input_fd(ctx))
+      close(fd);
+    if (result == 3)
+      return 128 + ctx->interrupt_signal;
+    if (result == 2)
+      return 1;
+    if (result != 0)
+      status = 1;
+  }
+  return status;
+}
+
+/*
+ * tee
+ * Copies the standard input to the standard output and to the files; -a appends to them
+ */
+int tee_input(lsh_ctx *ctx, char *args[]) {
+  bool append = args[1] != NULL && strcmp(args[1], "-a") == 0;
+  int files[MAX_ARGS_PER_LINE], count = 0, status = 0, result;
+
+  for (int i = append ? 2 : 1; args[i] != NULL && count < MAX_ARGS_PER_LINE; i++) {
+    if ((files[count] = open_in_context(ctx, args[i], O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC))) == -1) {
+      lsh_printf(ctx, LSH_STDERR, "tee: %s: %s\n", args[i], strerror(errno));
+      status = 1;
+      continue;
+    }
+    count++;
+  }
+
+  if ((result = copy_stream(ctx, lsh_input_fd(ctx), files, count)) == 3)
+    status = 128 + ctx->interrupt_signal;
+  else if (result != 0)
+    status = 1;
+  for (int i = 0; i < count; i++) {
+    if (files[i] != -1)
+      close(files[i]);
+    else if (status == 0)
+      status = 1;
+  }
+  return status;
 }
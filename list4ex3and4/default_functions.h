@@ -3,12 +3,29 @@
  * Configure the built-in shell functions
  */
 
-#include "lsh.h"
+#ifndef LSH_DEFAULT_FUNCTIONS_H
+#define LSH_DEFAULT_FUNCTIONS_H
+
+#include <stdbool.h>
+
+#include "context.h"
+#include "parser.h"
+
+// Every built-in function receives the context it runs in and returns the exit status
+typedef int (*lsh_builtin)(lsh_ctx *ctx, char *args[]);
 
 // Declares the built-in shell functions
-int change_directory(char* args[]);
-int show_help(char *args[]);
-int exit_shell(char *args[]);
+int change_directory(lsh_ctx *ctx, char *args[]);
+int show_help(lsh_ctx *ctx, char *args[]);
+int exit_shell(lsh_ctx *ctx, char *args[]);
+int echo_arguments(lsh_ctx *ctx, char *args[]);
+int concatenate_files(lsh_ctx *ctx, char *args[]);
+int tee_input(lsh_ctx *ctx, char *args[]);
 
 // Helper functions
 int number_of_builtin_functions();
+lsh_builtin find_builtin_function(char *args[], bool is_stage);
+bool is_thread_safe_builtin(const char *name);
+bool builtin_reads_input(const char *name);
+
+#endif
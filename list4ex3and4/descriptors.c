@@ -0,0 +1,309 @@
+/*
+ * descriptors.c
+ * Redirections of numbered descriptors (>>log, 3>>log, 2>&1, 3>&-), and the ones kept open
+ * across commands with 'exec', eg. exec 3>>log, so that the commands writing to the same file
+ * over and over don't open it every time
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "descriptors.h"
+
+/**
+ * Redirections of the command in the order they're applied: '<', '>' and '2>' first, then the numbered ones
+ */
+static int collect_redirections(const lsh_command *command, lsh_redirection redirections[]) {
+  int count = 0;
+
+  if (command->input_file != NULL)
+    redirections[count++] = (lsh_redirection) { 0, LSH_REDIRECT_READ, command->input_file, -1 };
+  if (command->output_file != NULL)
+    redirections[count++] = (lsh_redirection) { LSH_STDOUT, LSH_REDIRECT_WRITE, command->output_file, -1 };
+  if (command->error_file != NULL)
+    redirections[count++] = (lsh_redirection) { LSH_STDERR, LSH_REDIRECT_WRITE, command->error_file, -1 };
+
+  memcpy(redirections + count, command->redirections, command->redirection_count * sizeof(lsh_redirection));
+  return count + command->redirection_count;
+}
+
+static int file_flags(const lsh_redirection *redirection) {
+  switch (redirection->kind) {
+    case LSH_REDIRECT_READ:
+      return O_RDONLY;
+    case LSH_REDIRECT_APPEND:
+      return O_CREAT | O_APPEND | O_WRONLY;
+    default:
+      return O_CREAT | O_TRUNC | O_WRONLY;
+  }
+}
+
+/**
+ * Opens the file of the redirection relative to the context's directory, which is opened first if needed
+ */
+static int open_file(lsh_ctx *ctx, int *directory_fd, const lsh_redirection *redirection) {
+  if (*directory_fd == -1 && (*directory_fd = open(ctx->cwd, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1)
+    return -1;
+  return openat(*directory_fd, redirection->file, file_flags(redirection) | O_CLOEXEC, 0600);
+}
+
+/**
+ * Descriptor the commands get as the standard stream: the one set with 'exec', or the context's own
+ */
+int standard_stream(lsh_ctx *ctx, int stream) {
+  return ctx->persistent_fds[stream] != -1 ? ctx->persistent_fds[stream] : ctx->stdio[stream];
+}
+
+/**
+ * Descriptor of the context the commands know under the number, or -1 if there's none
+ */
+static int context_descriptor(lsh_ctx *ctx, int fd) {
+  if (ctx->persistent_fds[fd] != -1)
+    return ctx->persistent_fds[fd];
+  return fd <= LSH_STDERR ? ctx->stdio[fd] : -1;
+}
+
+static void list_persistent_descriptors(lsh_ctx *ctx) {
+  char link[32], path[PATH_MAX];
+  ssize_t length;
+
+  for (int fd = 0; fd <= MAX_REDIRECTED_FD; fd++) {
+    if (ctx->persistent_fds[fd] == -1)
+      continue;
+    snprintf(link, sizeof(link), "/proc/self/fd/%d", ctx->persistent_fds[fd]);
+    if ((length = readlink(link, path, sizeof(path) - 1)) == -1)
+      length = 0;
+    path[length] = '\0';
+    lsh_printf(ctx, LSH_STDOUT, "%d -> %s\n", fd, path);
+  }
+}
+
+/**
+ * exec REDIRECTION...: keeps the descriptors open in the context, so that the following commands use them
+ * without opening the files again, eg. exec 3>>log, then make >&3. 'exec >out' sends the output of all of
+ * the following commands to the file. 'exec' alone lists them.
+ * The standard streams can't be closed: the shell itself would lose them, so they're saved and restored
+ * instead, eg. exec 4>&1 >out, then exec >&4 4>&-.
+ */
+int execute_exec(lsh_ctx *ctx, lsh_pipeline *pipeline) {
+  lsh_command *command = &pipeline->commands[0];
+  lsh_redirection redirections[MAX_REDIRECTIONS + 3], *redirection;
+  int count, directory_fd = -1, fd, moved_fd, status = 0;
+  char name[16];
+
+  if (pipeline->command_count > 1 || pipeline->is_background || command->argc > 1) {
+    lsh_printf(ctx, LSH_STDERR, "lsh: exec: only redirections are supported, eg. exec 3>>log\n");
+    return 2;
+  }
+
+  if ((count = collect_redirections(command, redirections)) == 0) {
+    list_persistent_descriptors(ctx);
+    return 0;
+  }
+
+  for (int i = 0; i < count; i++) {
+    if (redirections[i].kind == LSH_REDIRECT_CLOSE && redirections[i].fd <= LSH_STDERR) {
+      lsh_printf(ctx, LSH_STDERR, "lsh: exec: %d: the standard streams can't be closed, save and restore them instead, eg. exec 4>&1 >out, then exec >&4 4>&-\n", redirections[i].fd);
+      return 2;
+    }
+  }
+
+  for (int i = 0; i < count; i++) {
+    redirection = &redirections[i];
+    fd = -1;
+
+    if (redirection->kind == LSH_REDIRECT_DUPLICATE) {
+      snprintf(name, sizeof(name), "%d", redirection->source_fd);
+      errno = EBADF;
+      if ((fd = context_descriptor(ctx, redirection->source_fd)) != -1)
+        fd = fcntl(fd, F_DUPFD_CLOEXEC, FIRST_PERSISTENT_FD);
+    }
+    else if (redirection->kind != LSH_REDIRECT_CLOSE && (fd = open_file(ctx, &directory_fd, redirection)) != -1) {
+      // The commands may name the low descriptors themselves, so the kept ones are moved out of their' way
+      moved_fd = fcntl(fd, F_DUPFD_CLOEXEC, FIRST_PERSISTENT_FD);
+      close(fd);
+      fd = moved_fd;
+    }
+
+    if (fd == -1 && redirection->kind != LSH_REDIRECT_CLOSE) {
+      lsh_printf(ctx, LSH_STDERR, "lsh: exec: %s: %s\n", redirection->file != NULL ? redirection->file : name, strerror(errno));
+      status = 1;
+      break;
+    }
+
+    if (ctx->persistent_fds[redirection->fd] != -1)
+      close(ctx->persistent_fds[redirection->fd]);
+    ctx->persistent_fds[redirection->fd] = fd;
+  }
+
+  if (directory_fd != -1)
+    close(directory_fd);
+  return status;
+}
+
+/**
+ * Applies the redirections of a builtin to its' standard streams. fds[] holds the descriptors it uses
+ * so far, owned by the caller, or -1 for the context's own ones; the replaced ones are closed.
+ * The other descriptors don't concern the builtins, so their' redirections are skipped.
+ * Returns false with the name of what couldn't be opened in failed, and errno set.
+ */
+bool redirect_streams(lsh_ctx *ctx, lsh_command *command, int fds[3], char *failed, size_t size) {
+  lsh_redirection redirections[MAX_REDIRECTIONS + 3], *redirection;
+  int count = collect_redirections(command, redirections), directory_fd = -1, source, fd;
+
+  for (int i = 0; i < count; i++) {
+    redirection = &redirections[i];
+    if (redirection->fd > LSH_STDERR)
+      continue;
+
+    if (redirection->kind == LSH_REDIRECT_CLOSE) {
+      // Whatever a builtin writes to a closed stream is lost
+      snprintf(failed, size, "/dev/null");
+      fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+    }
+    else if (redirection->kind == LSH_REDIRECT_DUPLICATE) {
+      snprintf(failed, size, "%d", redirection->source_fd);
+      source = redirection->source_fd <= LSH_STDERR && fds[redirection->source_fd] != -1 ? fds[redirection->source_fd] : context_descriptor(ctx, redirection->source_fd);
+      errno = EBADF;
+      fd = source != -1 ? fcntl(source, F_DUPFD_CLOEXEC, 0) : -1;
+    }
+    else {
+      snprintf(failed, size, "%s", redirection->file);
+      fd = open_file(ctx, &directory_fd, redirection);
+    }
+
+    if (fd == -1) {
+      if (directory_fd != -1)
+        close(directory_fd);
+      return false;
+    }
+    if (fds[redirection->fd] != -1)
+      close(fds[redirection->fd]);
+    fds[redirection->fd] = fd;
+  }
+
+  if (directory_fd != -1)
+    close(directory_fd);
+  return true;
+}
+
+/**
+ * Makes the descriptors kept with 'exec' visible to the command under their' numbers, then applies
+ * its' redirections. Runs in the child process (already in the context's directory), which quits
+ * if any of them fails.
+ */
+void redirect_child_descriptors(lsh_ctx *ctx, lsh_command *command) {
+  lsh_redirection redirections[MAX_REDIRECTIONS + 3], *redirection;
+  int count = collect_redirections(command, redirections), fd;
+  bool is_open[MAX_REDIRECTED_FD + 1] = { true, true, true };
+
+  // dup2() leaves out O_CLOEXEC, so the copies survive exec()
+  for (fd = LSH_STDERR + 1; fd <= MAX_REDIRECTED_FD; fd++) {
+    if (ctx->persistent_fds[fd] != -1)
+      is_open[fd] = dup2(ctx->persistent_fds[fd], fd) != -1;
+  }
+
+  for (int i = 0; i < count; i++) {
+    redirection = &redirections[i];
+
+    switch (redirection->kind) {
+      case LSH_REDIRECT_CLOSE:
+        close(redirection->fd);
+        is_open[redirection->fd] = false;
+        continue;
+
+      case LSH_REDIRECT_DUPLICATE:
+        // Other descriptors of the child are the shell's internal ones, eg. the pipes
+        if (!is_open[redirection->source_fd]) {
+          dprintf(STDERR_FILENO, "lsh: %d: %s\n", redirection->source_fd, strerror(EBADF));
+          _exit(1);
+        }
+        if (redirection->source_fd != redirection->fd && dup2(redirection->source_fd, redirection->fd) == -1) {
+          dprintf(STDERR_FILENO, "lsh: %d: %s\n", redirection->source_fd, strerror(errno));
+          _exit(1);
+        }
+        is_open[redirection->fd] = true;
+        continue;
+    }
+
+    if ((fd = open(redirection->file, file_flags(redirection), 0600)) == -1) {
+      dprintf(STDERR_FILENO, "lsh: %s: %s\n", redirection->file, strerror(errno));
+      _exit(1);
+    }
+    if (fd != redirection->fd) {
+      dup2(fd, redirection->fd);
+      close(fd);
+    }
+    is_open[redirection->fd] = true;
+  }
+}
+
+void close_persistent_descriptors(lsh_ctx *ctx) {
+  for (int fd = 0; fd <= MAX_REDIRECTED_FD; fd++) {
+    if (ctx->persistent_fds[fd] != -1) {
+      close(ctx->persistent_fds[fd]);
+      ctx->persistent_fds[fd] = -1;
+    }
+  }
+}
+
+/**
+ * Counts the descriptors open in the process, except for the ones kept with 'exec'.
+ * The other threads open and close their own in the meantime, so it's only meaningful with a single context.
+ */
+int count_open_descriptors(lsh_ctx *ctx) {
+  DIR *directory = opendir("/proc/self/fd");
+  struct dirent *entry;
+  int count = 0;
+
+  if (directory == NULL)
+    return -1;
+  while ((entry = readdir(directory)) != NULL) {
+    if (entry->d_name[0] != '.')
+      count++;
+  }
+  closedir(directory);
+
+  for (int fd = 0; fd <= MAX_REDIRECTED_FD; fd++) {
+    if (ctx->persistent_fds[fd] != -1)
+      count--;
+  }
+  return count;
+}
+
+/**
+ * Reports the descriptors the command line left open in the process, and the ones
+ * without O_CLOEXEC (past the standard ones), which every command would inherit
+ */
+void report_descriptor_leaks(lsh_ctx *ctx, int open_before, const char *line) {
+  int open_after = count_open_descriptors(ctx), fd;
+  char link[300], path[PATH_MAX];
+  DIR *directory;
+  struct dirent *entry;
+  ssize_t length;
+
+  if (open_before != -1 && open_after > open_before)
+    lsh_printf(ctx, LSH_STDERR, "lsh: %d descriptor(s) left open by '%.*s'\n", open_after - open_before, (int) strcspn(line, "\n"), line);
+
+  if ((directory = opendir("/proc/self/fd")) == NULL)
+    return;
+  while ((entry = readdir(directory)) != NULL) {
+    fd = atoi(entry->d_name);
+    if (entry->d_name[0] == '.' || fd <= LSH_STDERR || fd == dirfd(directory) || (fcntl(fd, F_GETFD) & FD_CLOEXEC))
+      continue;
+
+    snprintf(link, sizeof(link), "/proc/self/fd/%s", entry->d_name);
+    if ((length = readlink(link, path, sizeof(path) - 1)) == -1)
+      length = 0;
+    path[length] = '\0';
+    lsh_printf(ctx, LSH_STDERR, "lsh: descriptor %d (%s) has no O_CLOEXEC, every command inherits it\n", fd, path);
+  }
+  closedir(directory);
+}
@@ -0,0 +1,27 @@
+/*
+ * descriptors.h
+ * Redirections of numbered descriptors, and the ones kept open across commands with 'exec'
+ */
+
+#ifndef LSH_DESCRIPTORS_H
+#define LSH_DESCRIPTORS_H
+
+#include <stdbool.h>
+
+#include "context.h"
+#include "parser.h"
+
+// Definitions
+#define FIRST_PERSISTENT_FD 10 // The descriptors kept by 'exec' are moved above the ones the commands may name
+
+int standard_stream(lsh_ctx *ctx, int stream);
+int execute_exec(lsh_ctx *ctx, lsh_pipeline *pipeline);
+bool redirect_streams(lsh_ctx *ctx, lsh_command *command, int fds[3], char *failed, size_t size);
+void redirect_child_descriptors(lsh_ctx *ctx, lsh_command *command);
+void close_persistent_descriptors(lsh_ctx *ctx);
+
+// Leak reporting, see LSH_CHECK_FDS
+int count_open_descriptors(lsh_ctx *ctx);
+void report_descriptor_leaks(lsh_ctx *ctx, int open_before, const char *line);
+
+#endif
@@ -0,0 +1,699 @@
+/*
+ * executor.c
+ * Runs the parsed pipelines: forks the commands, connects them with pipes
+ * and handles the input/output redirections
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+
+#include "executor.h"
+#include "default_functions.h"
+#include "descriptors.h"
+#include "pipe_tuning.h"
+#include "stage_threads.h"
+
+#define CAPTURE_BUFFER_SIZE 65536
+#define DEFAULT_DEADLINE_GRACE_MS 5000 // Time between SIGTERM and SIGKILL, unless LSH_DEADLINE_GRACE says otherwise
+#define STOP_CHECK_INTERVAL_MS 50 // How often the pipelines with a deadline are checked for Ctrl-Z
+
+// Arguments of ioprio_set(), see linux/ioprio.h
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_SHIFT 13
+
+extern char **environ;
+
+/**
+ * Checks if the NAME=value entry sets one of the given variables
+ */
+static bool is_overridden(const char *entry, char **overrides, int count) {
+  size_t name_length;
+
+  for (int i = 0; i < count; i++) {
+    name_length = strchr(overrides[i], '=') - overrides[i];
+    if (strncmp(entry, overrides[i], name_length + 1) == 0)
+      return true;
+  }
+  return false;
+}
+
+/**
+ * Prepares the environment passed to the commands.
+ * It's the environment of the process with the context's own variables
+ * (see lsh_setenv()) on top, and the parent=<pathname> value pointing
+ * at the context's directory.
+ * Built before forking, so that the children don't have to allocate any memory.
+ */
+static char **build_environment(lsh_ctx *ctx) {
+  int count = 0, i, j = 0;
+  char **envp;
+
+  while (environ[count] != NULL)
+    count++;
+
+  if ((envp = malloc((count + ctx->environment_count + 2) * sizeof(char *))) == NULL)
+    return NULL;
+
+  for (i = 0; i < count; i++) {
+    if (strncmp(environ[i], "parent=", 7) != 0 && !is_overridden(environ[i], ctx->environment, ctx->environment_count))
+      envp[j++] = environ[i];
+  }
+  for (i = 0; i < ctx->environment_count; i++)
+    envp[j++] = ctx->environment[i];
+
+  if (asprintf(&envp[j++], "parent=%s", ctx->cwd) == -1) {
+    free(envp);
+    return NULL;
+  }
+  envp[j] = NULL;
+  return envp;
+}
+
+/**
+ * Releases the environment created by build_environment()
+ */
+static void free_environment(char **envp) {
+  int i = 0;
+
+  if (envp == NULL)
+    return;
+
+  // Our own parent=<pathname> entry is the last one
+  while (envp[i + 1] != NULL)
+    i++;
+  free(envp[i]);
+  free(envp);
+}
+
+/**
+ * Converts the status returned by waitpid() into the exit status of the command
+ */
+static int decode_status(int status) {
+  if (WIFEXITED(status))
+    return WEXITSTATUS(status);
+  if (WIFSIGNALED(status))
+    return 128 + WTERMSIG(status);
+  if (WIFSTOPPED(status))
+    return 128 + WSTOPSIG(status);
+  return 1;
+}
+
+/**
+ * Waits for the child to finish or stop (eg. after Ctrl-Z) and returns its' exit status
+ */
+static int wait_for_process(pid_t pid, bool *stopped) {
+  int status;
+
+  while (waitpid(pid, &status, WUNTRACED) == -1) {
+    // The signal handlers of the host process may interrupt the wait
+    if (errno != EINTR)
+      return 1;
+  }
+  *stopped = WIFSTOPPED(status);
+  return decode_status(status);
+}
+
+/**
+ * Arms the timer to go off once, after the given number of milliseconds
+ */
+static void arm_timer(int timer_fd, long milliseconds) {
+  struct itimerspec timer = { 0 };
+
+  timer.it_value.tv_sec = milliseconds / 1000;
+  timer.it_value.tv_nsec = milliseconds % 1000 * 1000000;
+  timerfd_settime(timer_fd, 0, &timer, NULL);
+}
+
+/**
+ * Waits for the commands of the pipeline, passing what they write to the capture pipes
+ * to the output callback, growing the buffers of the adaptive pipes whenever their writers
+ * stall, and enforcing the deadline - all in the same loop, so that none of them waits for the others.
+ * captures[] holds the read ends of the capture pipes, -1 if the output isn't captured.
+ * monitors[i] is the read end of the pipe between the i-th and the next command, or -1.
+ * Once the deadline passes the process group gets SIGTERM, and SIGKILL after the grace period.
+ * The exit status of each command is stored in statuses[].
+ * Returns the exit status of the last command: 124 if the deadline stopped it, 137 if it had to be killed.
+ * The wait ends early if any of the commands is stopped, the finished ones have 0 in pids[] then.
+ */
+static int wait_for_pipeline(lsh_ctx *ctx, pid_t pids[], int statuses[], int count, int captures[2], int monitors[], long deadline, long grace, pid_t group, bool *stopped) {
+  char buffer[CAPTURE_BUFFER_SIZE];
+  struct pollfd descriptors[MAX_COMMANDS_PER_PIPELINE + 3];
+  struct pollfd *timer = descriptors, *outputs = descriptors + 1, *exits = descriptors + 3;
+  int streams[2] = { LSH_STDOUT, LSH_STDERR };
+  long maximum_size = maximum_pipe_size();
+  int remaining = count, open_outputs = 0, status = 0, raw_status, signal_sent = 0, interval = STOP_CHECK_INTERVAL_MS, ready, queued, i;
+  uint64_t expirations;
+  ssize_t length;
+
+  // pidfds wake the shell up as soon as a command finishes; without them it just checks periodically.
+  // A stopped command doesn't make its' pidfd readable, so the shell checks for that periodically as
+  // well, instead of leaving a pipeline stopped with Ctrl-Z to its' deadline.
+  for (i = 0; i < count; i++) {
+    exits[i].fd = syscall(SYS_pidfd_open, pids[i], 0);
+    exits[i].events = POLLIN;
+    if (exits[i].fd == -1 || monitors[i] != -1)
+      interval = PIPE_MONITOR_INTERVAL_MS;
+  }
+
+  for (i = 0; i < 2; i++) {
+    outputs[i].fd = captures[i];
+    outputs[i].events = POLLIN;
+    if (captures[i] != -1)
+      open_outputs++;
+  }
+
+  // The timer lives in the shell, so that no timeout(1) process has to be started for the deadline
+  timer->fd = -1;
+  timer->events = POLLIN;
+  if (deadline > 0 && (timer->fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)) != -1)
+    arm_timer(timer->fd, deadline);
+
+  // The capture pipes are drained until all of their writers are gone, which may be after the commands
+  // finish (eg. the threads of the built-in stages), and the deadline still applies to them in the meantime
+  *stopped = false;
+  while ((remaining > 0 || open_outputs > 0) && !*stopped) {
+    ready = poll(descriptors, count + 3, remaining > 0 ? interval : -1);
+    if (ready > 0 && timer->fd != -1 && (timer->revents & POLLIN) && read(timer->fd, &expirations, sizeof(expirations)) > 0) {
+      // The first expiry is the deadline itself, the second one - the end of the grace period
+      signal_sent = signal_sent == 0 ? SIGTERM : SIGKILL;
+      killpg(group, signal_sent);
+      if (signal_sent == SIGTERM)
+        arm_timer(timer->fd, grace);
+      else {
+        close(timer->fd);
+        timer->fd = -1;
+      }
+    }
+
+    for (i = 0; i < 2 && ready > 0; i++) {
+      if (outputs[i].fd == -1 || outputs[i].revents == 0)
+        continue;
+
+      length = read(outputs[i].fd, buffer, sizeof(buffer));
+      if (length > 0) {
+        ctx->output_callback(ctx, streams[i], buffer, length, ctx->output_user_data);
+      }
+      else if (length == 0 || errno != EINTR) {
+        // End of the stream - every writer is gone
+        outputs[i].fd = -1;
+        open_outputs--;
+      }
+    }
+
+    for (i = 0; i < count; i++) {
+      if (pids[i] == 0 || waitpid(pids[i], &raw_status, WNOHANG | WUNTRACED) <= 0)
+        continue;
+
+      // Stopping any of the commands stops the whole pipeline (the terminal sends SIGTSTP to the group)
+      if (WIFSTOPPED(raw_status)) {
+        *stopped = true;
+        status = decode_status(raw_status);
+        continue;
+      }
+
+      statuses[i] = decode_status(raw_status);
+      if (i == count - 1)
+        status = statuses[i];
+      pids[i] = 0;
+      remaining--;
+      if (exits[i].fd != -1) {
+        close(exits[i].fd);
+        exits[i].fd = -1;
+      }
+
+      // Nobody writes to or reads from the pipes around the finished command anymore.
+      // Closing the copy of the read end lets the writer get SIGPIPE.
+      if (i > 0 && monitors[i - 1] != -1) {
+        close(monitors[i - 1]);
+        monitors[i - 1] = -1;
+      }
+      if (monitors[i] != -1) {
+        close(monitors[i]);
+        monitors[i] = -1;
+      }
+    }
+
+    grow_stalled_pipes(monitors, count, maximum_size);
+  }
+
+  // What the commands wrote before they stopped is still passed on, but the shell doesn't wait for more:
+  // the capture pipes are closed, so once resumed in the background the commands get SIGPIPE if they write to them
+  for (i = 0; i < 2 && *stopped; i++) {
+    if (outputs[i].fd == -1 || ioctl(outputs[i].fd, FIONREAD, &queued) == -1 || queued == 0)
+      continue;
+    if ((length = read(outputs[i].fd, buffer, (size_t) queued < sizeof(buffer) ? (size_t) queued : sizeof(buffer))) > 0)
+      ctx->output_callback(ctx, streams[i], buffer, length, ctx->output_user_data);
+  }
+
+  if (timer->fd != -1)
+    close(timer->fd);
+  for (i = 0; i < count; i++) {
+    if (exits[i].fd != -1)
+      close(exits[i].fd);
+  }
+  if (*stopped)
+    return status;
+
+  // Report the deadline the way timeout(1) does
+  if (signal_sent == SIGKILL)
+    return 128 + SIGKILL;
+  if (signal_sent == SIGTERM)
+    return 124;
+  return status;
+}
+
+/**
+ * Applies the launch modifiers of the command to the child process,
+ * so that no taskset/nice/ionice has to be executed in between.
+ * The child quits if any of them cannot be applied.
+ */
+static void apply_launch_modifiers(lsh_command *command) {
+  lsh_launch_modifiers *modifiers = &command->modifiers;
+  cpu_set_t cpus;
+
+  if (modifiers->has_cpus) {
+    CPU_ZERO(&cpus);
+    for (int cpu = 0; cpu < MAX_CPUS && cpu < CPU_SETSIZE; cpu++) {
+      if (modifiers->cpus[cpu / 8] & (1 << (cpu % 8)))
+        CPU_SET(cpu, &cpus);
+    }
+    if (sched_setaffinity(0, sizeof(cpus), &cpus) == -1) {
+      dprintf(STDERR_FILENO, "lsh: %s: unable to set the CPU affinity: %s\n", command->argv[0], strerror(errno));
+      _exit(1);
+    }
+  }
+
+  if (modifiers->has_nice && setpriority(PRIO_PROCESS, 0, modifiers->nice) == -1) {
+    dprintf(STDERR_FILENO, "lsh: %s: unable to set the nice value: %s\n", command->argv[0], strerror(errno));
+    _exit(1);
+  }
+
+  // glibc has no wrapper for ioprio_set()
+  if (modifiers->has_io && syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, modifiers->io_class << IOPRIO_CLASS_SHIFT | modifiers->io_level) == -1) {
+    dprintf(STDERR_FILENO, "lsh: %s: unable to set the I/O priority: %s\n", command->argv[0], strerror(errno));
+    _exit(1);
+  }
+}
+
+/**
+ * Runs a single command of the pipeline in the child process.
+ * is_stage tells whether the pipeline has more commands, see find_builtin_function().
+ * Never returns.
+ */
+static void run_stage(lsh_ctx *ctx, lsh_command *command, int input_fd, int output_fd, int error_fd, char **envp, pid_t group, bool is_foreground, bool is_stage) {
+  static const int job_control_signals[] = { SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU, SIGCHLD };
+  lsh_builtin builtin;
+
+  // Every pipeline is a process group of its' own, led by its' first command, so that
+  // a signal to the group reaches all of the commands (and whatever those start) at once.
+  // The foreground one takes over the terminal, so that Ctrl-C, Ctrl-\ and Ctrl-Z go
+  // straight to it. Both the parent and the child do it, whichever of them runs first.
+  setpgid(0, group);
+  if (is_foreground && ctx->terminal_fd != -1)
+    tcsetpgrp(ctx->terminal_fd, getpgrp());
+
+  // The shell ignores or handles the job control signals itself, the commands get the default actions
+  for (size_t i = 0; i < sizeof(job_control_signals) / sizeof(int); i++)
+    signal(job_control_signals[i], SIG_DFL);
+
+  if (chdir(ctx->cwd) == -1) {
+    dprintf(error_fd, "lsh: %s: %s\n", ctx->cwd, strerror(errno));
+    _exit(1);
+  }
+
+  // Connect the command to the pipes. The descriptors of the pipes
+  // themselves are created with O_CLOEXEC, so exec() closes them.
+  if (input_fd != STDIN_FILENO)
+    dup2(input_fd, STDIN_FILENO);
+  if (output_fd != STDOUT_FILENO)
+    dup2(output_fd, STDOUT_FILENO);
+  if (error_fd != STDERR_FILENO)
+    dup2(error_fd, STDERR_FILENO);
+
+  // Redirections take precedence over the pipes
+  redirect_child_descriptors(ctx, command);
+
+  apply_launch_modifiers(command);
+
+  // Built-in functions which are a part of a pipeline run in the child process
+  if ((builtin = find_builtin_function(command->argv, is_stage)) != NULL) {
+    ctx->output_callback = NULL;
+    ctx->stdio[0] = STDIN_FILENO;
+    ctx->stdio[LSH_STDOUT] = STDOUT_FILENO;
+    ctx->stdio[LSH_STDERR] = STDERR_FILENO;
+    ctx->builtin_fds[0] = ctx->builtin_fds[LSH_STDOUT] = ctx->builtin_fds[LSH_STDERR] = -1;
+    ctx->persistent_fds[0] = ctx->persistent_fds[LSH_STDOUT] = ctx->persistent_fds[LSH_STDERR] = -1;
+    _exit(builtin(ctx, command->argv));
+  }
+
+  execvpe(command->argv[0], command->argv, envp);
+
+  // If the user tries to launch commands/programs which are not available, return an error
+  dprintf(STDERR_FILENO, "lsh: command not found: %s\n", command->argv[0]);
+  _exit(127);
+}
+
+/**
+ * Marks the start of the built-in functions run in the shell's process, see lsh_interrupt()
+ */
+static void start_builtins(lsh_ctx *ctx) {
+  uint64_t pending;
+
+  ctx->interrupt_signal = 0;
+  while (read(ctx->interrupt_fd, &pending, sizeof(pending)) > 0);
+  ctx->builtins_running = true;
+}
+
+/**
+ * Runs a built-in function in the shell's own process, so that it can change the context.
+ * Redirections are applied to the context instead of the standard descriptors.
+ */
+static int run_builtin(lsh_ctx *ctx, lsh_command *command, lsh_builtin builtin) {
+  char failed[PATH_MAX];
+  int status = 1;
+
+  if (redirect_streams(ctx, command, ctx->builtin_fds, failed, sizeof(failed))) {
+    start_builtins(ctx);
+    status = builtin(ctx, command->argv);
+    ctx->builtins_running = false;
+  }
+  else
+    lsh_printf(ctx, LSH_STDERR, "lsh: %s: %s\n", failed, strerror(errno));
+
+  for (int stream = 0; stream <= LSH_STDERR; stream++) {
+    if (ctx->builtin_fds[stream] != -1) {
+      close(ctx->builtin_fds[stream]);
+      ctx->builtin_fds[stream] = -1;
+    }
+  }
+  return status;
+}
+
+/**
+ * Returns the shortest deadline set in the pipeline, in milliseconds, or 0
+ */
+static long get_pipeline_deadline(lsh_pipeline *pipeline) {
+  long deadline = 0;
+
+  for (int i = 0; i < pipeline->command_count; i++) {
+    if (pipeline->commands[i].modifiers.has_deadline && (deadline == 0 || pipeline->commands[i].modifiers.deadline < deadline))
+      deadline = pipeline->commands[i].modifiers.deadline;
+  }
+  return deadline;
+}
+
+/**
+ * Counts the free slots in the background job table
+ */
+static int free_background_slots(lsh_ctx *ctx) {
+  int count = 0;
+
+  for (int i = 0; i < MAX_BACKGROUND_JOBS; i++) {
+    if (ctx->background_jobs[i] == 0)
+      count++;
+  }
+  return count;
+}
+
+/**
+ * Remembers the background process, so that lsh_reap() can clean it up
+ */
+static void add_background_job(lsh_ctx *ctx, pid_t pid) {
+  for (int i = 0; i < MAX_BACKGROUND_JOBS; i++) {
+    if (ctx->background_jobs[i] == 0) {
+      ctx->background_jobs[i] = pid;
+      return;
+    }
+  }
+}
+
+/**
+ * Launches the pipeline.
+ * Commands can be either run in the foreground, or the background.
+ * Returns the exit status of the last command of the pipeline, the statuses of all of them are kept in the context.
+ */
+int execute_pipeline(lsh_ctx *ctx, lsh_pipeline *pipeline) {
+  pid_t pids[MAX_COMMANDS_PER_PIPELINE];
+  pthread_t threads[MAX_COMMANDS_PER_PIPELINE];
+  int process_stages[MAX_COMMANDS_PER_PIPELINE], process_statuses[MAX_COMMANDS_PER_PIPELINE], thread_stages[MAX_COMMANDS_PER_PIPELINE];
+  int started = 0, thread_count = 0, launched = 0, status = 0, i;
+  int standard_input = standard_stream(ctx, 0), input_fd = standard_input, output_fd, error_fd = standard_stream(ctx, LSH_STDERR);
+  int pipe_fds[2], capture_stdout[2] = { -1, -1 }, capture_stderr[2] = { -1, -1 }, captures[2];
+  int monitors[MAX_COMMANDS_PER_PIPELINE];
+  bool capture = ctx->output_callback != NULL && !pipeline->is_background, is_monitored = false;
+  bool capture_stdout_stream = capture && ctx->persistent_fds[LSH_STDOUT] == -1;
+  long default_pipe_size = PIPE_SIZE_DEFAULT, pipe_size, deadline, grace = DEFAULT_DEADLINE_GRACE_MS;
+  const char *pipe_size_variable, *grace_variable;
+  bool stopped = false, use_threads;
+  pid_t group = 0;
+  lsh_builtin builtin;
+  char **envp;
+
+  // 'exec' only changes the descriptors of the context
+  if (strcmp(pipeline->commands[0].argv[0], "exec") == 0)
+    return execute_exec(ctx, pipeline);
+
+  // A single built-in function is run in the shell's process, eg. 'cd' has to change the context
+  builtin = find_builtin_function(pipeline->commands[0].argv, pipeline->command_count > 1);
+  if (pipeline->command_count == 1 && !pipeline->is_background && builtin != NULL)
+    return run_builtin(ctx, &pipeline->commands[0], builtin);
+
+  // The deadline is enforced by the context while it waits, so it's left to the foreground
+  if ((deadline = get_pipeline_deadline(pipeline)) > 0 && pipeline->is_background) {
+    lsh_printf(ctx, LSH_STDERR, "lsh: deadlines cannot be set for background commands\n");
+    return 1;
+  }
+
+  // LSH_DEADLINE_GRACE sets how long the commands have to quit after SIGTERM
+  grace_variable = lsh_getenv(ctx, "LSH_DEADLINE_GRACE");
+  if (deadline > 0 && grace_variable != NULL && grace_variable[0] != '\0' && !parse_duration(grace_variable, &grace))
+    lsh_printf(ctx, LSH_STDERR, "lsh: invalid LSH_DEADLINE_GRACE, the default grace period will be used\n");
+
+  if (pipeline->is_background && free_background_slots(ctx) < pipeline->command_count) {
+    lsh_printf(ctx, LSH_STDERR, "lsh: too many background processes\n");
+    return 1;
+  }
+
+  // LSH_PIPE_SIZE sets the buffers of the pipes which are not given their own with '|{SIZE}'
+  pipe_size_variable = lsh_getenv(ctx, "LSH_PIPE_SIZE");
+  if (pipe_size_variable != NULL && pipe_size_variable[0] != '\0' && !parse_pipe_size(pipe_size_variable, &default_pipe_size))
+    lsh_printf(ctx, LSH_STDERR, "lsh: invalid LSH_PIPE_SIZE, the default pipe size will be used\n");
+
+  // The deadlines and the adaptive pipes need a PID for each command, so those pipelines fork every one of them
+  use_threads = !pipeline->is_background && deadline == 0;
+  for (i = 0; i < pipeline->command_count - 1; i++) {
+    pipe_size = pipeline->commands[i].pipe_size != PIPE_SIZE_DEFAULT ? pipeline->commands[i].pipe_size : default_pipe_size;
+    if (pipe_size == PIPE_SIZE_AUTO)
+      use_threads = false;
+  }
+
+  if ((envp = build_environment(ctx)) == NULL) {
+    lsh_printf(ctx, LSH_STDERR, "lsh: allocation error\n");
+    return 1;
+  }
+
+  // The output of the commands run in the foreground is passed back through the pipes
+  if (capture) {
+    if (pipe2(capture_stdout, O_CLOEXEC) == -1 || pipe2(capture_stderr, O_CLOEXEC) == -1) {
+      lsh_printf(ctx, LSH_STDERR, "lsh: %s\n", strerror(errno));
+      if (capture_stdout[0] != -1) {
+        close(capture_stdout[0]);
+        close(capture_stdout[1]);
+      }
+      free_environment(envp);
+      return 1;
+    }
+    // Streams redirected with 'exec' stay in their' files
+    if (ctx->persistent_fds[LSH_STDERR] == -1)
+      error_fd = capture_stderr[1];
+  }
+
+  // For each command between '|', the pipe to the next command is created,
+  // then the command is forked with its' standard input connected to the
+  // previous pipe and its' standard output - to the next one.
+  for (i = 0; i < pipeline->command_count; i++) {
+    monitors[i] = -1;
+    ctx->stage_statuses[i] = 1;
+  }
+  ctx->stage_count = pipeline->is_background ? 0 : pipeline->command_count;
+  if (use_threads)
+    start_builtins(ctx);
+
+  for (i = 0; i < pipeline->command_count; i++) {
+    output_fd = capture_stdout_stream ? capture_stdout[1] : standard_stream(ctx, LSH_STDOUT);
+
+    if (i < pipeline->command_count - 1) {
+      if (pipe2(pipe_fds, O_CLOEXEC) == -1) {
+        lsh_printf(ctx, LSH_STDERR, "lsh: %s\n", strerror(errno));
+        break;
+      }
+      output_fd = pipe_fds[1];
+
+      // Larger buffers mean fewer context switches between the commands.
+      // The adaptive pipes are watched through a copy of their read end while the pipeline runs.
+      pipe_size = pipeline->commands[i].pipe_size != PIPE_SIZE_DEFAULT ? pipeline->commands[i].pipe_size : default_pipe_size;
+      if (pipe_size > 0) {
+        set_pipe_size(pipe_fds[1], pipe_size);
+      }
+      else if (pipe_size == PIPE_SIZE_AUTO && !pipeline->is_background) {
+        monitors[i] = fcntl(pipe_fds[0], F_DUPFD_CLOEXEC, 0);
+        is_monitored = true;
+      }
+    }
+
+    // Built-in functions which only read and write their' streams run on threads of the shell, unless
+    // they'd read from the terminal: a thread can't be interrupted or stopped along with the pipeline
+    builtin = find_builtin_function(pipeline->commands[i].argv, pipeline->command_count > 1);
+    if (use_threads && builtin != NULL && is_thread_safe_builtin(pipeline->commands[i].argv[0])
+        && (i > 0 || pipeline->commands[i].input_file != NULL || !builtin_reads_input(pipeline->commands[i].argv[0]) || !isatty(input_fd))) {
+      thread_stages[thread_count] = i;
+      if (start_stage_thread(ctx, &pipeline->commands[i], builtin, input_fd, output_fd, error_fd, &threads[thread_count], &ctx->stage_statuses[i]))
+        thread_count++;
+    }
+    else {
+      if ((pids[started] = fork()) == -1) {
+        lsh_printf(ctx, LSH_STDERR, "lsh error: child process could not be created\n");
+        if (i < pipeline->command_count - 1) {
+          close(pipe_fds[0]);
+          close(pipe_fds[1]);
+        }
+        break;
+      }
+
+      // If the PID is equal to 0, it means that we're in a child process
+      if (pids[started] == 0)
+        run_stage(ctx, &pipeline->commands[i], input_fd, output_fd, error_fd, envp, group, !pipeline->is_background, pipeline->command_count > 1);
+
+      // The first forked command leads the group; see run_stage()
+      if (group == 0) {
+        group = pids[started];
+        if (!pipeline->is_background) {
+          ctx->foreground_group = group;
+          if (ctx->terminal_fd != -1)
+            tcsetpgrp(ctx->terminal_fd, group);
+        }
+      }
+      setpgid(pids[started], group);
+
+      process_stages[started++] = i;
+    }
+    launched++;
+
+    // Closes the descriptors which are now owned by the children
+    if (input_fd != standard_input)
+      close(input_fd);
+    if (i < pipeline->command_count - 1) {
+      close(pipe_fds[1]);
+      input_fd = pipe_fds[0];
+    }
+    else {
+      input_fd = standard_input;
+    }
+  }
+
+  if (input_fd != standard_input)
+    close(input_fd);
+  free_environment(envp);
+
+  // Only the commands keep the write ends of the capture pipes, so that they reach the end when all of them finish
+  if (capture) {
+    close(capture_stdout[1]);
+    close(capture_stderr[1]);
+  }
+
+  if (pipeline->is_background) {
+    // In order to create a background process, the context
+    // should just skip the call to wait. lsh_reap() will take
+    // care of the returning values of the children.
+    for (i = 0; i < started; i++)
+      add_background_job(ctx, pids[i]);
+    if (started > 0)
+      lsh_printf(ctx, LSH_STDOUT, "lsh: process created with PID: %d\n", pids[started - 1]);
+    lsh_reap(ctx);
+    return launched == pipeline->command_count ? 0 : 1;
+  }
+
+  // The pipes whose readers were never started cannot be watched
+  for (i = launched > 0 ? launched - 1 : 0; i < pipeline->command_count; i++) {
+    if (monitors[i] != -1) {
+      close(monitors[i]);
+      monitors[i] = -1;
+    }
+  }
+
+  // If the pipeline is not requested to be in background, we wait for the children to finish.
+  if (started > 0)
+    ctx->foreground_pid = pids[started - 1];
+  if (capture || is_monitored || deadline > 0) {
+    captures[0] = capture_stdout[0];
+    captures[1] = capture_stderr[0];
+    status = wait_for_pipeline(ctx, pids, process_statuses, started, captures, monitors, deadline, grace, group, &stopped);
+    if (capture) {
+      close(capture_stdout[0]);
+      close(capture_stderr[0]);
+    }
+  }
+  else {
+    for (i = 0; i < started && !stopped; i++) {
+      status = process_statuses[i] = wait_for_process(pids[i], &stopped);
+      if (!stopped)
+        pids[i] = 0;
+    }
+  }
+
+  // The commands which haven't finished report the signal which stopped the pipeline
+  for (i = 0; i < started; i++)
+    ctx->stage_statuses[process_stages[i]] = pids[i] == 0 ? process_statuses[i] : status;
+
+  // The threads carry on while the processes are stopped, they finish on their' own
+  for (i = 0; i < thread_count; i++) {
+    if (stopped)
+      pthread_detach(threads[i]);
+    else
+      ctx->stage_statuses[thread_stages[i]] = join_stage_thread(threads[i]);
+  }
+  ctx->builtins_running = false;
+  ctx->foreground_pid = -1;
+  ctx->foreground_group = -1;
+
+  // Take the terminal back, along with the modes the commands may have changed
+  if (group != 0 && ctx->terminal_fd != -1) {
+    tcsetpgrp(ctx->terminal_fd, getpgrp());
+    if (ctx->has_terminal_modes)
+      tcsetattr(ctx->terminal_fd, TCSADRAIN, &ctx->terminal_modes);
+  }
+
+  // A stopped pipeline is left to lsh_reap(), just like the background ones
+  if (stopped) {
+    for (i = 0; i < started; i++) {
+      if (pids[i] != 0)
+        add_background_job(ctx, pids[i]);
+    }
+    for (i = 0; i < pipeline->command_count; i++) {
+      if (monitors[i] != -1)
+        close(monitors[i]);
+    }
+    lsh_printf(ctx, LSH_STDERR, "\nlsh: process group %d stopped, 'kill -CONT -%d' resumes it in the background\n", group, group);
+  }
+
+  // Otherwise the status is the last command's, unless the deadline has passed
+  if (!stopped && deadline == 0 && launched > 0)
+    status = ctx->stage_statuses[launched - 1];
+
+  return launched == pipeline->command_count ? status : 1;
+}
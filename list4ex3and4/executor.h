@@ -0,0 +1,14 @@
+/*
+ * executor.h
+ * Runs the parsed pipelines
+ */
+
+#ifndef LSH_EXECUTOR_H
+#define LSH_EXECUTOR_H
+
+#include "context.h"
+#include "parser.h"
+
+int execute_pipeline(lsh_ctx *ctx, lsh_pipeline *pipeline);
+
+#endif
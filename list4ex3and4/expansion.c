@@ -0,0 +1,165 @@
+/*
+ * expansion.c
+ * Replaces the aliases and functions from the configuration before the line is parsed
+ *
+ * Only the name of each command is looked up and the result is not expanded again,
+ * so an alias may safely refer to the command it shadows, eg. alias ls=ls --color=auto
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "expansion.h"
+#include "parser.h"
+
+#define TOKENS_SEPARATORS " \n\t"
+#define MAX_TOKENS (MAX_ARGS_PER_LINE + MAX_COMMANDS_PER_PIPELINE * 4)
+
+/**
+ * Tells whether the token is a redirection, and if the name of a file follows it
+ */
+static bool is_redirection(const char *token, bool *has_file) {
+  lsh_redirection redirection;
+
+  // '<', '>' and '2>' are the numbered ones with a file as well
+  switch (parse_redirection(token, &redirection)) {
+    case LSH_REDIRECTION_FILE:
+      *has_file = true;
+      return true;
+    case LSH_REDIRECTION_COMPLETE:
+      *has_file = false;
+      return true;
+  }
+  return false;
+}
+
+static bool ends_command(const char *token) {
+  return token[0] == '|' || strcmp(token, "&") == 0;
+}
+
+/**
+ * Tells whether the token is a launch modifier, following the rules of the parser
+ */
+static bool is_launch_modifier(const char *token, bool after_modifier) {
+  if (token[0] == '@')
+    return true;
+  return after_modifier && (strncmp(token, "cpus=", 5) == 0 || strncmp(token, "nice=", 5) == 0 || strncmp(token, "io=", 3) == 0 || strncmp(token, "deadline=", 9) == 0);
+}
+
+/**
+ * Writes the body of the function with $1-$9 and $@ replaced by the arguments
+ */
+static void write_function_body(FILE *output, const char *body, char **args, int arg_count) {
+  for (const char *c = body; *c != '\0'; c++) {
+    if (c[0] == '$' && c[1] >= '1' && c[1] <= '9') {
+      if (c[1] - '0' <= arg_count)
+        fputs(args[c[1] - '1'], output);
+      c++;
+    }
+    else if (c[0] == '$' && c[1] == '@') {
+      for (int i = 0; i < arg_count; i++)
+        fprintf(output, i > 0 ? " %s" : "%s", args[i]);
+      c++;
+    }
+    else {
+      fputc(*c, output);
+    }
+  }
+}
+
+/**
+ * Expands the names of the commands which are aliases or functions.
+ * Lines the parser would reject are left for it to report.
+ */
+char *expand_definitions(lsh_ctx *ctx, const char *line) {
+  char *copy, *saveptr, *tokens[MAX_TOKENS], *result = NULL;
+  const char *definition;
+  bool at_command_start = true, after_modifier = false, expanded = false, has_file;
+  int token_count = 0, i, end;
+  long deadline;
+  size_t result_size;
+  FILE *output;
+
+  if (ctx->config == NULL)
+    return NULL;
+
+  if ((copy = strdup(line)) == NULL)
+    return NULL;
+  for (char *token = strtok_r(copy, TOKENS_SEPARATORS, &saveptr); token != NULL; token = strtok_r(NULL, TOKENS_SEPARATORS, &saveptr)) {
+    if (token_count == MAX_TOKENS) {
+      free(copy);
+      return NULL;
+    }
+    tokens[token_count++] = token;
+  }
+
+  if ((output = open_memstream(&result, &result_size)) == NULL) {
+    free(copy);
+    return NULL;
+  }
+
+  for (i = 0; i < token_count; i++) {
+    if (i > 0)
+      fputc(' ', output);
+
+    if (ends_command(tokens[i])) {
+      at_command_start = true;
+      after_modifier = false;
+      fputs(tokens[i], output);
+      continue;
+    }
+
+    // Redirections and modifiers may come before the name of the command
+    if (is_redirection(tokens[i], &has_file) && (!has_file || i + 1 < token_count)) {
+      fputs(tokens[i], output);
+      if (has_file)
+        fprintf(output, " %s", tokens[++i]);
+      continue;
+    }
+    if (at_command_start && strcmp(tokens[i], "timeout") == 0 && i + 1 < token_count && parse_duration(tokens[i + 1], &deadline)) {
+      fprintf(output, "%s %s", tokens[i], tokens[i + 1]);
+      after_modifier = true;
+      i++;
+      continue;
+    }
+    if (at_command_start && is_launch_modifier(tokens[i], after_modifier)) {
+      after_modifier = true;
+      fputs(tokens[i], output);
+      continue;
+    }
+
+    if (!at_command_start) {
+      fputs(tokens[i], output);
+      continue;
+    }
+    at_command_start = false;
+
+    if ((definition = config_lookup(ctx, CONFIG_ALIAS, tokens[i])) != NULL) {
+      // The arguments of the command simply follow the alias
+      fputs(definition, output);
+      expanded = true;
+    }
+    else if ((definition = config_lookup(ctx, CONFIG_FUNCTION, tokens[i])) != NULL) {
+      // The arguments go up to the end of the command or its' first redirection
+      for (end = i + 1; end < token_count && !ends_command(tokens[end]) && !is_redirection(tokens[end], &has_file); end++);
+      write_function_body(output, definition, tokens + i + 1, end - i - 1);
+      i = end - 1;
+      expanded = true;
+    }
+    else {
+      fputs(tokens[i], output);
+    }
+  }
+
+  fclose(output);
+  free(copy);
+  if (!expanded) {
+    free(result);
+    return NULL;
+  }
+  return result;
+}
@@ -0,0 +1,14 @@
+/*
+ * expansion.h
+ * Replaces the aliases and functions from the configuration before the line is parsed
+ */
+
+#ifndef LSH_EXPANSION_H
+#define LSH_EXPANSION_H
+
+#include "context.h"
+
+// Returns the expanded line, to be released with free(), or NULL if there was nothing to expand
+char *expand_definitions(lsh_ctx *ctx, const char *line);
+
+#endif
@@ -0,0 +1,108 @@
+/*
+ * fuzz_parser.c
+ * Fuzzing harness of lsh_parse(), checking that the parsed pipeline only points inside
+ * its' own copy of the line
+ *
+ * libFuzzer: make fuzz (clang -fsanitize=fuzzer,address,undefined)
+ * AFL:       afl-gcc -DFUZZ_STANDALONE fuzz_parser.c parser.c, then afl-fuzz -i fuzz/corpus -o findings -- ./a.out @@
+ * Replay:    make fuzz-replay, runs every file of the corpus once under ASan and UBSan
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "parser.h"
+
+#define TOKENS_SEPARATORS " \n\t"
+
+/**
+ * Checks that the word is a whole token of the pipeline's buffer
+ */
+static void check_word(const lsh_pipeline *pipeline, size_t buffer_length, const char *word) {
+  if (word == NULL || word < pipeline->buffer || word >= pipeline->buffer + buffer_length)
+    abort();
+  if (word[0] == '\0' || word[strcspn(word, TOKENS_SEPARATORS)] != '\0')
+    abort();
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  lsh_pipeline pipeline;
+  size_t buffer_length;
+  char *line;
+  int result;
+
+  // The parser takes a C string, so the input ends at its' first NUL byte
+  if ((line = malloc(size + 1)) == NULL)
+    return 0;
+  memcpy(line, data, size);
+  line[size] = '\0';
+
+  result = lsh_parse(line, &pipeline);
+  if (result == LSH_PARSE_ERROR && pipeline.error == NULL)
+    abort();
+
+  if (result == LSH_PARSE_OK) {
+    buffer_length = strlen(line) + 1;
+    if (pipeline.command_count < 1 || pipeline.command_count > MAX_COMMANDS_PER_PIPELINE)
+      abort();
+
+    for (int i = 0; i < pipeline.command_count; i++) {
+      lsh_command *command = &pipeline.commands[i];
+
+      if (command->argc < 1 || command->argv[command->argc] != NULL)
+        abort();
+      for (int j = 0; j < command->argc; j++)
+        check_word(&pipeline, buffer_length, command->argv[j]);
+
+      if (command->input_file != NULL)
+        check_word(&pipeline, buffer_length, command->input_file);
+      if (command->output_file != NULL)
+        check_word(&pipeline, buffer_length, command->output_file);
+      if (command->error_file != NULL)
+        check_word(&pipeline, buffer_length, command->error_file);
+      if (command->redirection_count < 0 || command->redirection_count > MAX_REDIRECTIONS)
+        abort();
+      for (int j = 0; j < command->redirection_count; j++) {
+        if (command->redirections[j].fd < 0 || command->redirections[j].fd > MAX_REDIRECTED_FD)
+          abort();
+        if (command->redirections[j].file != NULL)
+          check_word(&pipeline, buffer_length, command->redirections[j].file);
+      }
+    }
+  }
+  else if (result != LSH_PARSE_EMPTY && result != LSH_PARSE_ERROR) {
+    abort();
+  }
+
+  lsh_pipeline_free(&pipeline);
+  free(line);
+  return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+/**
+ * Runs the harness on each of the files given, or on the standard input
+ */
+int main(int argc, char *argv[]) {
+  static uint8_t data[1 << 20];
+  size_t size;
+  FILE *input;
+
+  for (int i = 1; i < argc || (argc == 1 && i == 1); i++) {
+    if (argc == 1)
+      input = stdin;
+    else if ((input = fopen(argv[i], "rb")) == NULL) {
+      perror(argv[i]);
+      return 1;
+    }
+
+    size = fread(data, 1, sizeof(data), input);
+    if (input != stdin)
+      fclose(input);
+    LLVMFuzzerTestOneInput(data, size);
+  }
+  return 0;
+}
+#endif
@@ -0,0 +1,333 @@
+/*
+ * job_storm.c
+ * Stress test of the background jobs: runs 'lsh SCRIPT' with N background jobs
+ * of random lifetimes and checks that the shell reaps every one of them exactly once
+ *
+ * usage: job-storm [-n JOBS] [-l MAX_LIFETIME_MS] [-s SEED] [-x LSH]
+ *
+ * The jobs are job-storm itself (job-storm --job MS [STATUS]), reporting their start and
+ * their exit through descriptor 3, which lsh passes on to them. The reaping is watched
+ * through pidfds: a job is reaped once the pidfd can no longer be signalled.
+ * job-storm becomes the subreaper of the jobs, so the ones lsh never reaped come back
+ * to it after lsh quits and are counted as left behind.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#define REPORT_FD 3 // Descriptor the jobs report to
+#define FINAL_STATUS 7 // Exit status of the last, foreground job - and so of lsh
+#define WATCH_INTERVAL_NS 200000 // How often the exited jobs are checked, the resolution of the latency
+#define SETTLE_MS 500 // How long the last job outlives the longest background one
+#define CPU_SAMPLE_INTERVAL 50 // The CPU time of lsh is read every this many checks
+
+typedef struct job {
+  pid_t pid;
+  int pidfd;
+  struct timespec exited;
+  bool has_exited;
+  bool is_reaped;
+  bool is_left_behind;
+  double latency_ms; // From the exit to the reaping, -1 if it was not observed
+} job;
+
+static job *jobs;
+static int job_count;
+
+static double elapsed_ms(const struct timespec *start, const struct timespec *end) {
+  return (end->tv_sec - start->tv_sec) * 1000.0 + (end->tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+/**
+ * A single job: reports its' start, sleeps and reports its' exit
+ */
+static int run_job(long lifetime_ms, int status) {
+  struct timespec lifetime = { lifetime_ms / 1000, lifetime_ms % 1000 * 1000000 }, now;
+
+  dprintf(REPORT_FD, "S %d\n", getpid());
+  while (nanosleep(&lifetime, &lifetime) == -1 && errno == EINTR);
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  dprintf(REPORT_FD, "E %d %ld %ld\n", getpid(), (long) now.tv_sec, now.tv_nsec);
+  return status;
+}
+
+static job *find_job(pid_t pid) {
+  for (int i = 0; i < job_count; i++) {
+    if (jobs[i].pid == pid)
+      return &jobs[i];
+  }
+  return NULL;
+}
+
+/**
+ * Handles a single line of the report
+ */
+static void handle_record(char *record, int *started, int *exited, int capacity) {
+  long seconds, nanoseconds;
+  job *current;
+  int pid;
+
+  if (sscanf(record, "S %d", &pid) == 1) {
+    if ((current = find_job(pid)) == NULL) {
+      if (job_count == capacity)
+        return;
+      current = &jobs[job_count++];
+      current->pid = pid;
+      current->latency_ms = -1;
+    }
+    (*started)++;
+
+    // A job which is already gone was reaped before it could be watched
+    if ((current->pidfd = syscall(SYS_pidfd_open, pid, 0)) == -1)
+      current->is_reaped = true;
+  }
+  else if (sscanf(record, "E %d %ld %ld", &pid, &seconds, &nanoseconds) == 3) {
+    if ((current = find_job(pid)) == NULL) {
+      // The exit overtook the start in the report, see the start above
+      if (job_count == capacity)
+        return;
+      current = &jobs[job_count++];
+      current->pid = pid;
+      current->pidfd = -1;
+      current->latency_ms = -1;
+    }
+    current->exited.tv_sec = seconds;
+    current->exited.tv_nsec = nanoseconds;
+    current->has_exited = true;
+    (*exited)++;
+  }
+}
+
+/**
+ * Reads the CPU time used by the process itself, without its' children, in seconds
+ */
+static bool read_process_cpu(pid_t pid, double *user, double *system) {
+  char path[64], stat[1024], *fields;
+  unsigned long user_ticks, system_ticks;
+  ssize_t length;
+  int fd;
+
+  snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+  if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+    return false;
+  length = read(fd, stat, sizeof(stat) - 1);
+  close(fd);
+  if (length <= 0)
+    return false;
+  stat[length] = '\0';
+
+  // utime and stime are the 12th and 13th fields after the name of the command
+  if ((fields = strrchr(stat, ')')) == NULL || sscanf(fields + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &user_ticks, &system_ticks) != 2)
+    return false;
+  *user = (double) user_ticks / sysconf(_SC_CLK_TCK);
+  *system = (double) system_ticks / sysconf(_SC_CLK_TCK);
+  return true;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+  double x = *(const double *) a, y = *(const double *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+int main(int argc, char *argv[]) {
+  char script_path[] = "/tmp/job-storm.XXXXXX", self[PATH_MAX], buffer[65536], *line, *newline;
+  const char *lsh = "./lsh";
+  int job_total = 2000, started = 0, exited = 0, reaped = 0, left_behind = 0, unobserved = 0;
+  int zombies, peak_zombies = 0, lsh_status = -1, report[2], option, status;
+  long max_lifetime_ms = 2000, self_length;
+  unsigned int seed = time(NULL);
+  struct timespec start, end, now, interval = { 0, WATCH_INTERVAL_NS };
+  double user_cpu = 0, system_cpu = 0;
+  long iteration = 0;
+  double *latencies;
+  int latency_count = 0;
+  bool lsh_running = true, report_open = true;
+  struct pollfd report_poll;
+  ssize_t length;
+  pid_t lsh_pid, pid;
+  FILE *script;
+
+  if (argc == 3 || argc == 4) {
+    if (strcmp(argv[1], "--job") == 0)
+      return run_job(atol(argv[2]), argc == 4 ? atoi(argv[3]) : 0);
+  }
+
+  while ((option = getopt(argc, argv, "n:l:s:x:")) != -1) {
+    switch (option) {
+      case 'n': job_total = atoi(optarg); break;
+      case 'l': max_lifetime_ms = atol(optarg); break;
+      case 's': seed = strtoul(optarg, NULL, 10); break;
+      case 'x': lsh = optarg; break;
+      default:
+        fprintf(stderr, "usage: job-storm [-n JOBS] [-l MAX_LIFETIME_MS] [-s SEED] [-x LSH]\n");
+        return 2;
+    }
+  }
+  if (job_total <= 0 || max_lifetime_ms < 0) {
+    fprintf(stderr, "job-storm: the number of jobs has to be positive and the lifetime non-negative\n");
+    return 2;
+  }
+
+  if ((self_length = readlink("/proc/self/exe", self, sizeof(self) - 1)) == -1) {
+    perror("job-storm: /proc/self/exe");
+    return 1;
+  }
+  self[self_length] = '\0';
+
+  // The script: N background jobs, then a foreground one which outlives all of them
+  srand(seed);
+  if ((option = mkstemp(script_path)) == -1 || (script = fdopen(option, "w")) == NULL) {
+    perror("job-storm: script");
+    return 1;
+  }
+  for (int i = 0; i < job_total; i++)
+    fprintf(script, "%s --job %ld &\n", self, max_lifetime_ms > 0 ? rand() % (max_lifetime_ms + 1) : 0);
+  fprintf(script, "%s --job %ld %d\n", self, max_lifetime_ms + SETTLE_MS, FINAL_STATUS);
+  fclose(script);
+
+  jobs = calloc(job_total + 1, sizeof(job));
+  latencies = calloc(job_total + 1, sizeof(double));
+  if (jobs == NULL || latencies == NULL) {
+    fprintf(stderr, "job-storm: allocation error\n");
+    return 1;
+  }
+
+  // The jobs lsh fails to reap are passed to us once it quits, instead of init
+  prctl(PR_SET_CHILD_SUBREAPER, 1);
+
+  if (pipe2(report, O_CLOEXEC) == -1) {
+    perror("job-storm: pipe");
+    return 1;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if ((lsh_pid = fork()) == 0) {
+    int null_fd = open("/dev/null", O_WRONLY);
+
+    // The 'process created' lines are not of interest
+    dup2(null_fd, STDOUT_FILENO);
+    dup2(report[1], REPORT_FD);
+    execl(lsh, lsh, script_path, (char *) NULL);
+    perror("job-storm: lsh");
+    _exit(127);
+  }
+  close(report[1]);
+  if (lsh_pid == -1) {
+    perror("job-storm: fork");
+    return 1;
+  }
+
+  report_poll.fd = report[0];
+  report_poll.events = POLLIN;
+  line = buffer;
+
+  while (lsh_running || report_open) {
+    if (report_open && ppoll(&report_poll, 1, &interval, NULL) > 0) {
+      length = read(report[0], line, sizeof(buffer) - (line - buffer) - 1);
+      if (length <= 0) {
+        report_open = false;
+      }
+      else {
+        line[length] = '\0';
+        line = buffer;
+        while ((newline = strchr(line, '\n')) != NULL) {
+          *newline = '\0';
+          handle_record(line, &started, &exited, job_total + 1);
+          line = newline + 1;
+        }
+        // Keep the incomplete record for the next read
+        memmove(buffer, line, strlen(line) + 1);
+        line = buffer + strlen(buffer);
+      }
+    }
+    else if (!report_open) {
+      nanosleep(&interval, NULL);
+    }
+
+    // The exited jobs are reaped as soon as their pidfds can no longer be signalled
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    zombies = 0;
+    for (int i = 0; i < job_count; i++) {
+      if (!jobs[i].has_exited || jobs[i].is_reaped || jobs[i].pidfd == -1)
+        continue;
+
+      if (syscall(SYS_pidfd_send_signal, jobs[i].pidfd, 0, NULL, 0) == -1 && errno == ESRCH) {
+        jobs[i].is_reaped = true;
+        jobs[i].latency_ms = elapsed_ms(&jobs[i].exited, &now);
+        close(jobs[i].pidfd);
+        jobs[i].pidfd = -1;
+      }
+      else {
+        zombies++;
+      }
+    }
+    if (zombies > peak_zombies)
+      peak_zombies = zombies;
+
+    // The rusage of lsh would include its' jobs, so its' own CPU time is sampled while it's still there
+    if (lsh_running && iteration++ % CPU_SAMPLE_INTERVAL == 0)
+      read_process_cpu(lsh_pid, &user_cpu, &system_cpu);
+
+    if (lsh_running && waitpid(lsh_pid, &status, WNOHANG) == lsh_pid) {
+      lsh_running = false;
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      lsh_status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    }
+  }
+
+  // Whatever is still around was never reaped by lsh
+  while ((pid = wait(NULL)) > 0) {
+    job *current = find_job(pid);
+
+    if (current != NULL && !current->is_left_behind) {
+      current->is_left_behind = true;
+      left_behind++;
+    }
+  }
+
+  for (int i = 0; i < job_count; i++) {
+    if (jobs[i].is_left_behind)
+      continue;
+    if (jobs[i].is_reaped)
+      reaped++;
+    if (jobs[i].is_reaped && jobs[i].latency_ms >= 0)
+      latencies[latency_count++] = jobs[i].latency_ms;
+    else if (jobs[i].is_reaped)
+      unobserved++;
+  }
+  qsort(latencies, latency_count, sizeof(double), compare_doubles);
+  unlink(script_path);
+
+  // The last job is the foreground one
+  printf("jobs: %d background, %d started, %d exited, %d reaped by lsh, %d left behind\n", job_total, started - 1, exited - 1, reaped - 1, left_behind);
+  if (latency_count > 0) {
+    printf("reaping latency: p50 %.3f ms, p99 %.3f ms, max %.3f ms (%d reaped before they could be watched)\n",
+      latencies[latency_count / 2], latencies[latency_count * 99 / 100], latencies[latency_count - 1], unobserved);
+  }
+  printf("peak zombies: %d\n", peak_zombies);
+  printf("lsh: exit status %d, user %.3f s, system %.3f s, wall %.3f s\n", lsh_status, user_cpu, system_cpu, elapsed_ms(&start, &end) / 1000);
+
+  // Every job has to be reaped once, and the foreground status must not be lost to the reaping
+  if (started != job_total + 1 || exited != job_total + 1 || reaped != job_total + 1 || left_behind > 0 || lsh_status != FINAL_STATUS) {
+    printf("FAILED\n");
+    return 1;
+  }
+  printf("OK\n");
+  return 0;
+}
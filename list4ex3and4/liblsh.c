@@ -0,0 +1,375 @@
+/*
+ * liblsh.c
+ * Embeddable lsh: creation of the contexts and evaluation of the command lines
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/wait.h>
+
+#include "cache.h"
+#include "config.h"
+#include "context.h"
+#include "default_functions.h"
+#include "descriptors.h"
+#include "executor.h"
+#include "expansion.h"
+#include "parser.h"
+
+__thread int lsh_stage_fds[3] = { -1, -1, -1 };
+
+/**
+ * Creates a new context, starting in the current directory of the process
+ */
+lsh_ctx *lsh_ctx_new(void) {
+  lsh_ctx *ctx = calloc(1, sizeof(lsh_ctx));
+
+  if (ctx == NULL)
+    return NULL;
+
+  if (getcwd(ctx->cwd, sizeof(ctx->cwd)) == NULL || (ctx->interrupt_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == -1) {
+    free(ctx);
+    return NULL;
+  }
+
+  atomic_init(&ctx->references, 1);
+  ctx->foreground_pid = ctx->foreground_group = -1;
+  ctx->terminal_fd = -1;
+  ctx->stdio[0] = STDIN_FILENO;
+  ctx->stdio[LSH_STDOUT] = STDOUT_FILENO;
+  ctx->stdio[LSH_STDERR] = STDERR_FILENO;
+  ctx->builtin_fds[0] = ctx->builtin_fds[LSH_STDOUT] = ctx->builtin_fds[LSH_STDERR] = -1;
+  for (int fd = 0; fd <= MAX_REDIRECTED_FD; fd++)
+    ctx->persistent_fds[fd] = -1;
+  return ctx;
+}
+
+/**
+ * Destroys the context.
+ * Background processes which are still running are left alone.
+ * The builtins still running on the threads of a stopped pipeline are told to quit,
+ * and the context itself is only freed once the last of them is done with it.
+ */
+void lsh_ctx_free(lsh_ctx *ctx) {
+  uint64_t wake_up = 1;
+
+  if (ctx == NULL)
+    return;
+
+  ctx->interrupt_signal = SIGHUP;
+  write(ctx->interrupt_fd, &wake_up, sizeof(wake_up));
+
+  lsh_reap(ctx);
+  config_release(ctx);
+  close_persistent_descriptors(ctx);
+  for (int i = 0; i < ctx->environment_count; i++)
+    free(ctx->environment[i]);
+  free(ctx->environment);
+  lsh_ctx_release(ctx);
+}
+
+/**
+ * Frees the rest of the context with the last reference to it.
+ * The stage threads only use its' working directory and the interrupt.
+ */
+void lsh_ctx_release(lsh_ctx *ctx) {
+  if (atomic_fetch_sub(&ctx->references, 1) > 1)
+    return;
+
+  close(ctx->interrupt_fd);
+  free(ctx);
+}
+
+void lsh_set_output_callback(lsh_ctx *ctx, lsh_output_callback callback, void *user_data) {
+  ctx->output_callback = callback;
+  ctx->output_user_data = user_data;
+}
+
+void lsh_set_stdio(lsh_ctx *ctx, int input_fd, int output_fd, int error_fd) {
+  ctx->stdio[0] = input_fd;
+  ctx->stdio[LSH_STDOUT] = output_fd;
+  ctx->stdio[LSH_STDERR] = error_fd;
+}
+
+/**
+ * Sets the variable in the context, replacing its' previous value.
+ * Returns 0 on success, -1 if the name is invalid or the memory runs out.
+ */
+int lsh_setenv(lsh_ctx *ctx, const char *name, const char *value) {
+  size_t name_length = strlen(name);
+  char *entry, **environment;
+  int i;
+
+  if (name_length == 0 || strchr(name, '=') != NULL)
+    return -1;
+
+  if (asprintf(&entry, "%s=%s", name, value) == -1)
+    return -1;
+
+  for (i = 0; i < ctx->environment_count; i++) {
+    if (strncmp(ctx->environment[i], entry, name_length + 1) == 0) {
+      free(ctx->environment[i]);
+      ctx->environment[i] = entry;
+      return 0;
+    }
+  }
+
+  if ((environment = realloc(ctx->environment, (ctx->environment_count + 1) * sizeof(char *))) == NULL) {
+    free(entry);
+    return -1;
+  }
+  ctx->environment = environment;
+  ctx->environment[ctx->environment_count++] = entry;
+  return 0;
+}
+
+const char *lsh_getenv(lsh_ctx *ctx, const char *name) {
+  size_t name_length = strlen(name);
+
+  for (int i = 0; i < ctx->environment_count; i++) {
+    if (strncmp(ctx->environment[i], name, name_length) == 0 && ctx->environment[i][name_length] == '=')
+      return ctx->environment[i] + name_length + 1;
+  }
+  return getenv(name);
+}
+
+/**
+ * Parses the line and runs it in the context
+ */
+int lsh_eval(lsh_ctx *ctx, const char *line) {
+  lsh_pipeline pipeline;
+  const char *check_fds = lsh_getenv(ctx, "LSH_CHECK_FDS");
+  char *expanded;
+  int result, open_before = -1;
+
+  // Clean up the background commands first, in case nobody handles SIGCHLD
+  lsh_reap(ctx);
+  ctx->stage_count = 0;
+
+  // Aliases and functions are replaced before the line is parsed
+  expanded = expand_definitions(ctx, line);
+  result = lsh_parse(expanded != NULL ? expanded : line, &pipeline);
+  free(expanded);
+  if (result == LSH_PARSE_OK) {
+    if (check_fds != NULL && *check_fds != '\0')
+      open_before = count_open_descriptors(ctx);
+
+    if (is_cached_pipeline(&pipeline))
+      ctx->status = execute_cached_pipeline(ctx, &pipeline);
+    else
+      ctx->status = execute_pipeline(ctx, &pipeline);
+
+    // The cached command lines have a single status
+    if (ctx->stage_count == 0) {
+      ctx->stage_statuses[0] = ctx->status;
+      ctx->stage_count = 1;
+    }
+
+    if (check_fds != NULL && *check_fds != '\0')
+      report_descriptor_leaks(ctx, open_before, line);
+  }
+  else if (result == LSH_PARSE_ERROR) {
+    lsh_printf(ctx, LSH_STDERR, "lsh: %s\n", pipeline.error);
+    ctx->status = LSH_STATUS_SYNTAX_ERROR;
+  }
+  // An empty line leaves the previous status alone
+
+  lsh_pipeline_free(&pipeline);
+  return ctx->status;
+}
+
+int lsh_status(const lsh_ctx *ctx) {
+  return ctx->status;
+}
+
+int lsh_pipeline_status(const lsh_ctx *ctx, int *statuses, int max) {
+  for (int i = 0; i < ctx->stage_count && i < max; i++)
+    statuses[i] = ctx->stage_statuses[i];
+  return ctx->stage_count;
+}
+
+bool lsh_exit_requested(const lsh_ctx *ctx) {
+  return ctx->exit_requested;
+}
+
+const char *lsh_cwd(const lsh_ctx *ctx) {
+  return ctx->cwd;
+}
+
+/**
+ * Changes the directory of the context, just like the 'cd' builtin.
+ * Returns 0 on success.
+ */
+int lsh_chdir(lsh_ctx *ctx, const char *path) {
+  char *args[] = { "cd", (char *) path, NULL };
+
+  return change_directory(ctx, args);
+}
+
+pid_t lsh_foreground_pid(const lsh_ctx *ctx) {
+  return ctx->foreground_pid;
+}
+
+pid_t lsh_foreground_group(const lsh_ctx *ctx) {
+  return ctx->foreground_group;
+}
+
+bool lsh_interrupt(lsh_ctx *ctx, int signal) {
+  pid_t group = ctx->foreground_group;
+  uint64_t wake_up = 1;
+  bool delivered = group > 0 && killpg(group, signal) == 0;
+
+  // The builtins can't be stopped, only quit
+  if (ctx->builtins_running && signal != SIGTSTP) {
+    ctx->interrupt_signal = signal;
+    write(ctx->interrupt_fd, &wake_up, sizeof(wake_up));
+    delivered = true;
+  }
+  return delivered;
+}
+
+void lsh_set_terminal(lsh_ctx *ctx, int terminal_fd, const struct termios *modes) {
+  ctx->terminal_fd = terminal_fd;
+  ctx->has_terminal_modes = modes != NULL;
+  if (modes != NULL)
+    ctx->terminal_modes = *modes;
+}
+
+/**
+ * Go through the background processes to make sure that there are no more children which need to be handled.
+ * WNOHANG (non-blocking call) makes sure that the call never blocks, and only the context's
+ * own background processes are waited for, so the foreground ones are never stolen from lsh_eval().
+ */
+static int reap_each_job(lsh_ctx *ctx) {
+  int reaped = 0;
+  pid_t pid;
+
+  for (int i = 0; i < MAX_BACKGROUND_JOBS; i++) {
+    pid = ctx->background_jobs[i];
+    if (pid > 0 && waitpid(pid, NULL, WNOHANG) > 0) {
+      ctx->background_jobs[i] = 0;
+      reaped++;
+    }
+  }
+  return reaped;
+}
+
+static int find_background_job(lsh_ctx *ctx, pid_t pid) {
+  for (int i = 0; i < MAX_BACKGROUND_JOBS; i++) {
+    if (ctx->background_jobs[i] == pid)
+      return i;
+  }
+  return -1;
+}
+
+/**
+ * Cleans up the finished background processes.
+ * The finished children are looked at without being reaped first (WNOWAIT), so that only
+ * the ones which have actually finished cost a system call, instead of every job on every SIGCHLD.
+ * A child which is not one of the context's jobs (eg. a command of the foreground pipeline)
+ * cannot be skipped this way, so the jobs are then checked one by one.
+ */
+int lsh_reap(lsh_ctx *ctx) {
+  int reaped = 0, saved_errno = errno, slot;
+  siginfo_t info;
+
+  while (true) {
+    info.si_pid = 0;
+    if (waitid(P_ALL, 0, &info, WEXITED | WNOHANG | WNOWAIT) == -1 || info.si_pid == 0)
+      break;
+
+    if ((slot = find_background_job(ctx, info.si_pid)) == -1) {
+      reaped += reap_each_job(ctx);
+      break;
+    }
+
+    // Another call (eg. from the signal handler) may have reaped it in the meantime
+    if (waitpid(info.si_pid, NULL, WNOHANG) > 0) {
+      ctx->background_jobs[slot] = 0;
+      reaped++;
+    }
+  }
+
+  errno = saved_errno;
+  return reaped;
+}
+
+void lsh_wait_background(lsh_ctx *ctx) {
+  pid_t pid;
+
+  for (int i = 0; i < MAX_BACKGROUND_JOBS; i++) {
+    pid = ctx->background_jobs[i];
+    if (pid > 0) {
+      while (waitpid(pid, NULL, 0) == -1 && errno == EINTR);
+      ctx->background_jobs[i] = 0;
+    }
+  }
+}
+
+/**
+ * Descriptor the builtins read their' input from
+ */
+int lsh_input_fd(lsh_ctx *ctx) {
+  if (lsh_stage_fds[0] != -1)
+    return lsh_stage_fds[0];
+  if (ctx->builtin_fds[0] != -1)
+    return ctx->builtin_fds[0];
+  return standard_stream(ctx, 0);
+}
+
+/**
+ * Writes the output of a builtin or a message of the shell: to the descriptor of the pipeline's stage,
+ * to the redirected descriptor (or the one kept with 'exec'), to the output callback, or to the standard descriptor
+ */
+int lsh_write(lsh_ctx *ctx, int stream, const char *data, size_t length) {
+  int fd = lsh_stage_fds[stream] != -1 ? lsh_stage_fds[stream] : ctx->builtin_fds[stream];
+  ssize_t written;
+
+  // A stream redirected with 'exec' takes precedence over the capture
+  if (fd == -1)
+    fd = ctx->persistent_fds[stream];
+
+  if (fd == -1 && ctx->output_callback != NULL) {
+    ctx->output_callback(ctx, stream, data, length, ctx->output_user_data);
+    return 0;
+  }
+
+  if (fd == -1)
+    fd = ctx->stdio[stream];
+
+  while (length > 0) {
+    if ((written = write(fd, data, length)) == -1) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    data += written;
+    length -= written;
+  }
+  return 0;
+}
+
+void lsh_printf(lsh_ctx *ctx, int stream, const char *format, ...) {
+  char buffer[1024];
+  va_list arguments;
+  int length;
+
+  va_start(arguments, format);
+  length = vsnprintf(buffer, sizeof(buffer), format, arguments);
+  va_end(arguments);
+
+  if (length < 0)
+    return;
+  if (length >= (int) sizeof(buffer))
+    length = sizeof(buffer) - 1;
+  lsh_write(ctx, stream, buffer, length);
+}
@@ -0,0 +1,115 @@
+/*
+ * liblsh.h
+ * Embeddable lsh: parses and runs command lines without spawning /bin/sh
+ *
+ * Every piece of state lives in an lsh_ctx, so separate threads can run
+ * commands at the same time as long as each of them uses its' own context.
+ */
+
+#ifndef LIBLSH_H
+#define LIBLSH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <termios.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct lsh_ctx lsh_ctx;
+
+// Streams passed to the output callback
+#define LSH_STDOUT 1
+#define LSH_STDERR 2
+
+// Exit status reported when the line could not be parsed
+#define LSH_STATUS_SYNTAX_ERROR 2
+
+/*
+ * Receives the output of the commands run by lsh_eval().
+ * stream is either LSH_STDOUT or LSH_STDERR.
+ */
+typedef void (*lsh_output_callback)(lsh_ctx *ctx, int stream, const char *data, size_t length, void *user_data);
+
+// Creates and destroys the context. The builtins left running by a stopped pipeline are told to quit,
+// and keep what they use of the context until they do.
+lsh_ctx *lsh_ctx_new(void);
+void lsh_ctx_free(lsh_ctx *ctx);
+
+// Captures stdout and stderr of the commands instead of passing them to the caller's descriptors.
+// Passing NULL as the callback turns the capture off.
+void lsh_set_output_callback(lsh_ctx *ctx, lsh_output_callback callback, void *user_data);
+
+// Descriptors used as the standard input, output and error of the commands (0, 1 and 2 by default).
+// They stay owned by the caller.
+void lsh_set_stdio(lsh_ctx *ctx, int input_fd, int output_fd, int error_fd);
+
+// Sets the environment variable for the commands run in this context only
+int lsh_setenv(lsh_ctx *ctx, const char *name, const char *value);
+
+// Sources of the configuration loaded with lsh_load_config()
+#define LSH_CONFIG_MISSING 0 // There is no rc file
+#define LSH_CONFIG_SNAPSHOT 1 // Mapped from the up to date snapshot
+#define LSH_CONFIG_PARSED 2 // Parsed from the rc file, the snapshot has been rewritten
+
+typedef struct lsh_config_info {
+  int source;
+  int alias_count;
+  int function_count;
+  int variable_count;
+} lsh_config_info;
+
+// Loads the aliases, functions, variables and the prompt from the rc file (eg. ~/.lshrc).
+// Returns 0 on success, also when the file does not exist. info may be NULL.
+int lsh_load_config(lsh_ctx *ctx, const char *path, lsh_config_info *info);
+
+// Format of the prompt set in the rc file, or NULL
+const char *lsh_prompt(const lsh_ctx *ctx);
+
+// Runs the command line, eg. "sort < in.txt | uniq -c > out.txt", and returns its' exit status
+int lsh_eval(lsh_ctx *ctx, const char *line);
+
+// Exit status of the last command line (128 + signal number, if it was killed)
+int lsh_status(const lsh_ctx *ctx);
+
+// Exit statuses of each of the commands of the last pipeline, like $PIPESTATUS.
+// Fills up to max of them and returns how many commands there were.
+int lsh_pipeline_status(const lsh_ctx *ctx, int *statuses, int max);
+
+// True once the 'exit' builtin has been run in this context
+bool lsh_exit_requested(const lsh_ctx *ctx);
+
+// Working directory of the context, changed with the 'cd' builtin or lsh_chdir()
+const char *lsh_cwd(const lsh_ctx *ctx);
+int lsh_chdir(lsh_ctx *ctx, const char *path);
+
+// PID of the command currently running in the foreground, or -1
+pid_t lsh_foreground_pid(const lsh_ctx *ctx);
+
+// Process group of the pipeline running in the foreground, or -1.
+// Every pipeline gets a group of its' own, so signals sent to it reach all of its' commands.
+pid_t lsh_foreground_group(const lsh_ctx *ctx);
+
+// Sends the signal to the foreground pipeline, and stops the built-in functions the context runs in
+// the shell's process (eg. 'cat /dev/zero | tee /dev/null'), which no signal reaches, unless it's SIGTSTP.
+// Safe to call from a signal handler. Returns false if nothing was running in the foreground.
+bool lsh_interrupt(lsh_ctx *ctx, int signal);
+
+// Makes the foreground pipelines take over the terminal while they run. Afterwards the caller's
+// process group gets it back and the given modes (if not NULL) are restored. -1 turns it off.
+void lsh_set_terminal(lsh_ctx *ctx, int terminal_fd, const struct termios *modes);
+
+// Cleans up the background commands which have finished. Safe to call from a SIGCHLD handler.
+// Returns the number of commands reaped.
+int lsh_reap(lsh_ctx *ctx);
+
+// Waits until all of the background commands of the context finish
+void lsh_wait_background(lsh_ctx *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
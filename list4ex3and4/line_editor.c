@@ -0,0 +1,777 @@
+/*
+ * line_editor.c
+ * Line editor of the interactive shell. The text is kept in a gap buffer, and only the part
+ * of the screen which changed is redrawn. Pastes arrive in the bracketed paste mode, so that
+ * they're inserted as a whole and drawn once, instead of key by key.
+ */
+
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "line_editor.h"
+
+#define INPUT_BUFFER_SIZE 65536
+#define INITIAL_TEXT_SIZE 256
+#define ESCAPE_TIMEOUT_MS 50 // How long the rest of an escape sequence is waited for after ESC
+#define CONTINUATION_PROMPT "> " // Shown in front of each line but the first one
+
+// Sequences of the terminal
+#define PASTE_MODE_ON "\x1b[?2004h"
+#define PASTE_MODE_OFF "\x1b[?2004l"
+#define PASTE_END "\x1b[201~"
+#define CLEAR_SCREEN "\x1b[H\x1b[2J"
+#define CLEAR_BELOW "\x1b[J"
+
+// Keys other than the single bytes
+enum {
+  KEY_NONE = -2,
+  KEY_EOF = -1,
+  KEY_LEFT = 256,
+  KEY_RIGHT,
+  KEY_UP,
+  KEY_DOWN,
+  KEY_HOME,
+  KEY_END,
+  KEY_DELETE,
+  KEY_PASTE,
+  KEY_ALT_ENTER
+};
+
+typedef struct byte_buffer {
+  char *data;
+  size_t length, capacity;
+} byte_buffer;
+
+// Where the terminal puts the text, see layout_step()
+typedef struct layout {
+  size_t row, column;
+  int escape; // 1 after ESC, 2 inside a CSI sequence
+} layout;
+
+struct line_editor {
+  int input_fd, output_fd;
+  struct termios modes, raw_modes;
+
+  // The text is text[0, gap_start) followed by text[gap_end, capacity), the cursor is at the gap
+  char *text;
+  size_t gap_start, gap_end, capacity;
+
+  // Bytes read from the terminal but not handled yet, eg. the keys typed ahead
+  char input[INPUT_BUFFER_SIZE];
+  size_t input_start, input_end;
+  bool after_return; // The pasted "\r\n" is a single line break, even if it's split between two reads
+
+  // The prompt and the text as the screen shows them, the ones to be shown, and the output getting there
+  byte_buffer shown, rendered, output;
+  size_t shown_cursor, rendered_cursor;
+  const char *prompt;
+
+  byte_buffer line;
+};
+
+static bool reserve(byte_buffer *buffer, size_t extra) {
+  size_t capacity = buffer->capacity > 0 ? buffer->capacity : INITIAL_TEXT_SIZE;
+  char *data;
+
+  if (buffer->length + extra <= buffer->capacity)
+    return true;
+  while (capacity < buffer->length + extra)
+    capacity *= 2;
+  if ((data = realloc(buffer->data, capacity)) == NULL)
+    return false;
+  buffer->data = data;
+  buffer->capacity = capacity;
+  return true;
+}
+
+static void append(byte_buffer *buffer, const char *data, size_t length) {
+  if (length > 0 && reserve(buffer, length)) {
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+  }
+}
+
+static void append_move(byte_buffer *buffer, size_t count, char direction) {
+  char sequence[32];
+
+  append(buffer, sequence, snprintf(sequence, sizeof(sequence), "\x1b[%zu%c", count, direction));
+}
+
+static void write_all(int fd, const char *data, size_t length) {
+  ssize_t written;
+
+  while (length > 0) {
+    if ((written = write(fd, data, length)) == -1) {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+    data += written;
+    length -= written;
+  }
+}
+
+/*
+ * Gap buffer
+ */
+
+static size_t text_length(const line_editor *editor) {
+  return editor->capacity - (editor->gap_end - editor->gap_start);
+}
+
+static char char_at(const line_editor *editor, size_t position) {
+  return position < editor->gap_start ? editor->text[position] : editor->text[position + editor->gap_end - editor->gap_start];
+}
+
+static bool is_continuation_byte(char c) {
+  return (c & 0xC0) == 0x80;
+}
+
+/**
+ * Moves the gap (and so the cursor) to the position
+ */
+static void move_cursor_to(line_editor *editor, size_t position) {
+  size_t count;
+
+  if (position < editor->gap_start) {
+    count = editor->gap_start - position;
+    memmove(editor->text + editor->gap_end - count, editor->text + position, count);
+    editor->gap_start -= count;
+    editor->gap_end -= count;
+  }
+  else if (position > editor->gap_start) {
+    count = position - editor->gap_start;
+    memmove(editor->text + editor->gap_start, editor->text + editor->gap_end, count);
+    editor->gap_start += count;
+    editor->gap_end += count;
+  }
+}
+
+/**
+ * Inserts the text at the cursor, growing the buffer if the gap is too small
+ */
+static void insert_text(line_editor *editor, const char *data, size_t length) {
+  size_t after = editor->capacity - editor->gap_end, capacity = editor->capacity;
+  char *text;
+
+  if (editor->gap_end - editor->gap_start < length) {
+    while (capacity - text_length(editor) < length)
+      capacity *= 2;
+    if ((text = realloc(editor->text, capacity)) == NULL)
+      return;
+    memmove(text + capacity - after, text + editor->gap_end, after);
+    editor->text = text;
+    editor->gap_end = capacity - after;
+    editor->capacity = capacity;
+  }
+  memcpy(editor->text + editor->gap_start, data, length);
+  editor->gap_start += length;
+}
+
+/**
+ * Deletes the text between the positions, the cursor ends up in their' place
+ */
+static void delete_text(line_editor *editor, size_t from, size_t to) {
+  move_cursor_to(editor, from);
+  editor->gap_end += to - from;
+}
+
+static size_t previous_character(const line_editor *editor, size_t position) {
+  if (position == 0)
+    return 0;
+  do
+    position--;
+  while (position > 0 && is_continuation_byte(char_at(editor, position)));
+  return position;
+}
+
+static size_t next_character(const line_editor *editor, size_t position) {
+  size_t length = text_length(editor);
+
+  if (position >= length)
+    return length;
+  do
+    position++;
+  while (position < length && is_continuation_byte(char_at(editor, position)));
+  return position;
+}
+
+static size_t line_start(const line_editor *editor, size_t position) {
+  while (position > 0 && char_at(editor, position - 1) != '\n')
+    position--;
+  return position;
+}
+
+static size_t line_end(const line_editor *editor, size_t position) {
+  size_t length = text_length(editor);
+
+  while (position < length && char_at(editor, position) != '\n')
+    position++;
+  return position;
+}
+
+/**
+ * Position in the line above or below, in the same column if it's long enough
+ */
+static size_t vertical_target(const line_editor *editor, bool up) {
+  size_t start = line_start(editor, editor->gap_start), column = editor->gap_start - start, end, target;
+
+  if (up) {
+    if (start == 0)
+      return editor->gap_start;
+    end = start - 1;
+    start = line_start(editor, end);
+  }
+  else {
+    if ((end = line_end(editor, editor->gap_start)) == text_length(editor))
+      return editor->gap_start;
+    start = end + 1;
+    end = line_end(editor, start);
+  }
+
+  target = start + column < end ? start + column : end;
+  while (target > start && is_continuation_byte(char_at(editor, target)))
+    target--;
+  return target;
+}
+
+/*
+ * Screen
+ */
+
+/**
+ * Follows a single byte of the text the way the terminal does: the escape sequences (eg. colors
+ * of the prompt) and UTF-8 continuation bytes take no room, and after the last column is filled,
+ * the next character goes to the next row
+ */
+static void layout_step(layout *position, unsigned char c, size_t width) {
+  if (position->escape == 1) {
+    position->escape = c == '[' ? 2 : 0;
+  }
+  else if (position->escape == 2) {
+    if (c >= 0x40 && c <= 0x7e)
+      position->escape = 0;
+  }
+  else if (c == 0x1b) {
+    position->escape = 1;
+  }
+  else if (c == '\n') {
+    position->row++;
+    position->column = 0;
+  }
+  else if (c >= 0x20 && c != 0x7f && !is_continuation_byte(c)) {
+    if (position->column == width) {
+      position->row++;
+      position->column = 0;
+    }
+    position->column++;
+  }
+}
+
+static size_t rendered_line_start(const byte_buffer *text, size_t offset) {
+  while (offset > 0 && text->data[offset - 1] != '\n')
+    offset--;
+  return offset;
+}
+
+/**
+ * Row and column of the offset, counted from the base (which starts a row).
+ * Returns true if the row before is full, and so the cursor only moves to the offset's row with the next character.
+ */
+static bool locate(const byte_buffer *text, size_t base, size_t offset, size_t width, layout *position) {
+  memset(position, 0, sizeof(layout));
+  for (size_t i = base; i < offset; i++)
+    layout_step(position, text->data[i], width);
+
+  if (position->column < width)
+    return false;
+  position->row++;
+  position->column = 0;
+  return true;
+}
+
+/**
+ * First offset shown in the row, counted from the base
+ */
+static size_t offset_at_row(const byte_buffer *text, size_t base, size_t row, size_t width) {
+  layout position = { 0 };
+  size_t offset;
+
+  for (offset = base; offset < text->length; offset++) {
+    if (position.row + (position.column == width) >= row && !is_continuation_byte(text->data[offset]))
+      break;
+    layout_step(&position, text->data[offset], width);
+  }
+  return offset;
+}
+
+/**
+ * Moves the cursor of the terminal between the offsets of the text on the screen.
+ * The rows which scrolled off the top of the screen can't be reached, the cursor stops at the first visible one.
+ * Returns the offset the cursor ended up at.
+ */
+static size_t move_on_screen(line_editor *editor, const byte_buffer *text, size_t from, size_t to, size_t width, size_t height) {
+  size_t base = rendered_line_start(text, from < to ? from : to);
+  layout from_position, to_position, end_position;
+
+  locate(text, base, from, width, &from_position);
+  locate(text, base, to, width, &to_position);
+  if (to < from) {
+    locate(text, base, text->length, width, &end_position);
+    if (end_position.row - to_position.row >= height) {
+      to = offset_at_row(text, base, end_position.row - height + 1, width);
+      locate(text, base, to, width, &to_position);
+    }
+  }
+
+  if (to_position.row < from_position.row)
+    append_move(&editor->output, from_position.row - to_position.row, 'A');
+  else if (to_position.row > from_position.row)
+    append_move(&editor->output, to_position.row - from_position.row, 'B');
+
+  if (to_position.column == 0 && from_position.column != 0)
+    append(&editor->output, "\r", 1);
+  else if (to_position.column > from_position.column)
+    append_move(&editor->output, to_position.column - from_position.column, 'C');
+  else if (to_position.column < from_position.column)
+    append_move(&editor->output, from_position.column - to_position.column, 'D');
+  return to;
+}
+
+/**
+ * Checks whether the offset is still on the screen, ie. it's less than a screen above the end of the text
+ */
+static bool is_visible(const byte_buffer *text, size_t offset, size_t width, size_t height) {
+  size_t base = rendered_line_start(text, offset);
+  layout position, end_position;
+
+  locate(text, base, offset, width, &position);
+  locate(text, base, text->length, width, &end_position);
+  return end_position.row - position.row < height;
+}
+
+/**
+ * Adds the part of the text to the rendering, with the line breaks followed by the continuation
+ * prompt and the control characters shown as ^X
+ */
+static void render_span(byte_buffer *rendered, const char *data, size_t length) {
+  size_t start = 0;
+  char caret[2] = { '^' };
+
+  for (size_t i = 0; i < length; i++) {
+    unsigned char c = data[i];
+
+    if (c >= 0x20 && c != 0x7f)
+      continue;
+    append(rendered, data + start, i - start);
+    if (c == '\n') {
+      append(rendered, "\n" CONTINUATION_PROMPT, strlen("\n" CONTINUATION_PROMPT));
+    }
+    else {
+      caret[1] = c ^ 0x40;
+      append(rendered, caret, 2);
+    }
+    start = i + 1;
+  }
+  append(rendered, data + start, length - start);
+}
+
+static void render(line_editor *editor) {
+  editor->rendered.length = 0;
+  append(&editor->rendered, editor->prompt, strlen(editor->prompt));
+  render_span(&editor->rendered, editor->text, editor->gap_start);
+  editor->rendered_cursor = editor->rendered.length;
+  render_span(&editor->rendered, editor->text + editor->gap_end, editor->capacity - editor->gap_end);
+}
+
+static size_t terminal_width(line_editor *editor, size_t *height) {
+  struct winsize size;
+
+  if (ioctl(editor->output_fd, TIOCGWINSZ, &size) == -1 || size.ws_col == 0 || size.ws_row == 0) {
+    *height = 24;
+    return 80;
+  }
+  *height = size.ws_row;
+  return size.ws_col;
+}
+
+/**
+ * Brings the screen up to date with the text: only what follows the first difference from
+ * the text shown before is written, and then the cursor is put in its' place
+ */
+static void refresh(line_editor *editor) {
+  byte_buffer *shown = &editor->shown, *rendered = &editor->rendered, swap;
+  size_t width, height, common = 0, limit, cursor = editor->shown_cursor;
+  layout position;
+
+  render(editor);
+  width = terminal_width(editor, &height);
+  editor->output.length = 0;
+
+  limit = shown->length < rendered->length ? shown->length : rendered->length;
+  while (common < limit && shown->data[common] == rendered->data[common])
+    common++;
+  while (common > 0 && ((common < rendered->length && is_continuation_byte(rendered->data[common]))
+                         || (common < shown->length && is_continuation_byte(shown->data[common]))))
+    common--;
+
+  if (common < shown->length || common < rendered->length) {
+    if (!is_visible(shown, common, width, height)) {
+      // The change is above the screen: the whole text is written again below
+      move_on_screen(editor, shown, cursor, shown->length, width, height);
+      append(&editor->output, "\r\n", 2);
+      common = 0;
+    }
+    else {
+      // A character right after a full row is written along with the one before it, so that a line break
+      // after it doesn't skip a row
+      if (common > 0 && rendered->data[common - 1] != '\n' && locate(shown, rendered_line_start(shown, common), common, width, &position)) {
+        do
+          common--;
+        while (common > 0 && is_continuation_byte(rendered->data[common]));
+      }
+      move_on_screen(editor, shown, cursor, common, width, height);
+    }
+
+    for (size_t i = common, start = common; i <= rendered->length; i++) {
+      if (i == rendered->length || rendered->data[i] == '\n') {
+        append(&editor->output, rendered->data + start, i - start);
+        if (i < rendered->length)
+          append(&editor->output, "\r\n", 2);
+        start = i + 1;
+      }
+    }
+    if (rendered->length > 0 && rendered->data[rendered->length - 1] != '\n'
+        && locate(rendered, rendered_line_start(rendered, rendered->length), rendered->length, width, &position))
+      append(&editor->output, "\r\n", 2);
+    if (common < shown->length)
+      append(&editor->output, CLEAR_BELOW, strlen(CLEAR_BELOW));
+    cursor = rendered->length;
+  }
+
+  editor->rendered_cursor = move_on_screen(editor, rendered, cursor, editor->rendered_cursor, width, height);
+  write_all(editor->output_fd, editor->output.data, editor->output.length);
+
+  swap = *shown;
+  *shown = *rendered;
+  *rendered = swap;
+  editor->shown_cursor = editor->rendered_cursor;
+}
+
+/**
+ * Starts the next line below the text, as if it was never there
+ */
+static void forget_text(line_editor *editor) {
+  editor->gap_start = 0;
+  editor->gap_end = editor->capacity;
+  editor->shown.length = 0;
+  editor->shown_cursor = 0;
+}
+
+/*
+ * Input
+ */
+
+/**
+ * Next byte typed by the user. With a timeout (in milliseconds) it returns -1 if nothing comes in time,
+ * otherwise it waits for as long as it takes, and returns -1 at the end of the input.
+ */
+static int next_byte(line_editor *editor, int timeout) {
+  struct pollfd descriptor = { .fd = editor->input_fd, .events = POLLIN };
+  ssize_t length;
+
+  while (editor->input_start == editor->input_end) {
+    if (timeout >= 0 && poll(&descriptor, 1, timeout) <= 0)
+      return -1;
+    if ((length = read(editor->input_fd, editor->input, sizeof(editor->input))) == -1 && errno == EINTR)
+      continue;
+    if (length <= 0)
+      return -1;
+    editor->input_start = 0;
+    editor->input_end = length;
+  }
+  return (unsigned char) editor->input[editor->input_start++];
+}
+
+/**
+ * Reads a key, decoding the escape sequences of the terminal
+ */
+static int read_key(line_editor *editor) {
+  int c, number = 0;
+  bool is_first_number = true;
+
+  if ((c = next_byte(editor, -1)) == -1)
+    return KEY_EOF;
+  if (c != 0x1b)
+    return c;
+
+  // A lone ESC is ignored
+  if ((c = next_byte(editor, ESCAPE_TIMEOUT_MS)) == -1)
+    return KEY_NONE;
+  if (c == '\r')
+    return KEY_ALT_ENTER;
+
+  if (c == 'O') {
+    switch (next_byte(editor, ESCAPE_TIMEOUT_MS)) {
+      case 'A': return KEY_UP;
+      case 'B': return KEY_DOWN;
+      case 'C': return KEY_RIGHT;
+      case 'D': return KEY_LEFT;
+      case 'H': return KEY_HOME;
+      case 'F': return KEY_END;
+      default: return KEY_NONE;
+    }
+  }
+  if (c != '[')
+    return KEY_NONE;
+
+  // CSI sequence: parameters, then the final byte. Only the first parameter matters here.
+  while ((c = next_byte(editor, ESCAPE_TIMEOUT_MS)) != -1 && c >= 0x30 && c <= 0x3f) {
+    if (c == ';')
+      is_first_number = false;
+    else if (isdigit(c) && is_first_number && number < 1000)
+      number = number * 10 + c - '0';
+  }
+
+  switch (c) {
+    case 'A': return KEY_UP;
+    case 'B': return KEY_DOWN;
+    case 'C': return KEY_RIGHT;
+    case 'D': return KEY_LEFT;
+    case 'H': return KEY_HOME;
+    case 'F': return KEY_END;
+    case '~':
+      switch (number) {
+        case 1: case 7: return KEY_HOME;
+        case 4: case 8: return KEY_END;
+        case 3: return KEY_DELETE;
+        case 200: return KEY_PASTE;
+      }
+  }
+  return KEY_NONE;
+}
+
+/**
+ * Turns the line breaks of the pasted text ("\r", "\r\n") into '\n', in place.
+ * Returns the new length.
+ */
+static size_t convert_line_breaks(line_editor *editor, char *data, size_t length) {
+  size_t converted = 0;
+
+  for (size_t i = 0; i < length; i++) {
+    if (data[i] == '\n' && editor->after_return) {
+      editor->after_return = false;
+      continue;
+    }
+    editor->after_return = data[i] == '\r';
+    data[converted++] = editor->after_return ? '\n' : data[i];
+  }
+  return converted;
+}
+
+/**
+ * Inserts everything up to the end of the paste at once, reading as much of it
+ * as the terminal has with every read()
+ */
+static void insert_paste(line_editor *editor) {
+  size_t marker_length = strlen(PASTE_END), available, length;
+  char *start, *end;
+  ssize_t received;
+
+  editor->after_return = false;
+  for (;;) {
+    start = editor->input + editor->input_start;
+    available = editor->input_end - editor->input_start;
+    end = memmem(start, available, PASTE_END, marker_length);
+
+    // Without the marker, the last bytes may be its' beginning
+    length = end != NULL ? (size_t) (end - start) : available >= marker_length ? available - marker_length + 1 : 0;
+    insert_text(editor, start, convert_line_breaks(editor, start, length));
+    editor->input_start += length;
+    if (end != NULL) {
+      editor->input_start += marker_length;
+      return;
+    }
+
+    available = editor->input_end - editor->input_start;
+    memmove(editor->input, editor->input + editor->input_start, available);
+    editor->input_start = 0;
+    editor->input_end = available;
+    while ((received = read(editor->input_fd, editor->input + available, sizeof(editor->input) - available)) == -1 && errno == EINTR)
+      ;
+    if (received <= 0)
+      return;
+    editor->input_end += received;
+  }
+}
+
+/**
+ * Handles a single key. Returns false once the line is done.
+ */
+static bool handle_key(line_editor *editor, int key, bool *is_eof) {
+  size_t position = editor->gap_start;
+  char c = key;
+
+  switch (key) {
+    case KEY_EOF:
+      *is_eof = text_length(editor) == 0;
+      return false;
+    case '\r':
+    case '\n':
+      return false;
+    case 4: // Ctrl-D
+      if (text_length(editor) == 0) {
+        *is_eof = true;
+        return false;
+      }
+      // fall through
+    case KEY_DELETE:
+      delete_text(editor, position, next_character(editor, position));
+      break;
+    case 0x7f: // Backspace
+    case 8:
+      delete_text(editor, previous_character(editor, position), position);
+      break;
+    case KEY_ALT_ENTER:
+      insert_text(editor, "\n", 1);
+      break;
+    case KEY_LEFT:
+    case 2: // Ctrl-B
+      move_cursor_to(editor, previous_character(editor, position));
+      break;
+    case KEY_RIGHT:
+    case 6: // Ctrl-F
+      move_cursor_to(editor, next_character(editor, position));
+      break;
+    case KEY_HOME:
+    case 1: // Ctrl-A
+      move_cursor_to(editor, line_start(editor, position));
+      break;
+    case KEY_END:
+    case 5: // Ctrl-E
+      move_cursor_to(editor, line_end(editor, position));
+      break;
+    case KEY_UP:
+    case 16: // Ctrl-P
+      move_cursor_to(editor, vertical_target(editor, true));
+      break;
+    case KEY_DOWN:
+    case 14: // Ctrl-N
+      move_cursor_to(editor, vertical_target(editor, false));
+      break;
+    case 11: // Ctrl-K
+      delete_text(editor, position, line_end(editor, position));
+      break;
+    case 21: // Ctrl-U
+      delete_text(editor, line_start(editor, position), position);
+      break;
+    case 23: // Ctrl-W
+      while (position > 0 && isspace((unsigned char) char_at(editor, position - 1)))
+        position--;
+      while (position > 0 && !isspace((unsigned char) char_at(editor, position - 1)))
+        position--;
+      delete_text(editor, position, editor->gap_start);
+      break;
+    case 12: // Ctrl-L
+      write_all(editor->output_fd, CLEAR_SCREEN, strlen(CLEAR_SCREEN));
+      editor->shown.length = 0;
+      editor->shown_cursor = 0;
+      break;
+    case 3: // Ctrl-C drops the text and starts over
+      move_cursor_to(editor, text_length(editor));
+      refresh(editor);
+      write_all(editor->output_fd, "^C\r\n", 4);
+      forget_text(editor);
+      break;
+    case KEY_PASTE:
+      insert_paste(editor);
+      break;
+    default:
+      if (key == '\t' || (key >= 0x20 && key < 0x100))
+        insert_text(editor, &c, 1);
+  }
+  return true;
+}
+
+line_editor *line_editor_new(int input_fd, int output_fd, const struct termios *modes) {
+  line_editor *editor = calloc(1, sizeof(line_editor));
+
+  if (editor == NULL || (editor->text = malloc(INITIAL_TEXT_SIZE)) == NULL) {
+    free(editor);
+    return NULL;
+  }
+  editor->input_fd = input_fd;
+  editor->output_fd = output_fd;
+  editor->capacity = editor->gap_end = INITIAL_TEXT_SIZE;
+
+  // Keys are read one by one, without the echo, and Ctrl-C, Ctrl-Z etc. are keys as well
+  editor->modes = *modes;
+  editor->raw_modes = *modes;
+  editor->raw_modes.c_iflag &= ~(BRKINT | ICRNL | INLCR | IGNCR | ISTRIP | IXON);
+  editor->raw_modes.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+  editor->raw_modes.c_cc[VMIN] = 1;
+  editor->raw_modes.c_cc[VTIME] = 0;
+  return editor;
+}
+
+void line_editor_free(line_editor *editor) {
+  if (editor == NULL)
+    return;
+  free(editor->text);
+  free(editor->shown.data);
+  free(editor->rendered.data);
+  free(editor->output.data);
+  free(editor->line.data);
+  free(editor);
+}
+
+/**
+ * Lets the user edit the line, until Enter. The keys typed ahead are all handled before the screen
+ * is redrawn, and so is a paste.
+ */
+char *line_editor_read(line_editor *editor, const char *prompt) {
+  bool is_eof = false;
+  size_t after, width, height;
+  layout position;
+
+  editor->prompt = prompt;
+  forget_text(editor);
+  tcsetattr(editor->input_fd, TCSADRAIN, &editor->raw_modes);
+  write_all(editor->output_fd, PASTE_MODE_ON, strlen(PASTE_MODE_ON));
+  refresh(editor);
+
+  while (handle_key(editor, read_key(editor), &is_eof)) {
+    if (editor->input_start == editor->input_end)
+      refresh(editor);
+  }
+
+  // The output of the commands starts below the text, unless the text filled its' last row and the cursor is below it already
+  move_cursor_to(editor, text_length(editor));
+  refresh(editor);
+  width = terminal_width(editor, &height);
+  if (!locate(&editor->shown, rendered_line_start(&editor->shown, editor->shown.length), editor->shown.length, width, &position))
+    write_all(editor->output_fd, "\r\n", 2);
+  write_all(editor->output_fd, PASTE_MODE_OFF, strlen(PASTE_MODE_OFF));
+  tcsetattr(editor->input_fd, TCSADRAIN, &editor->modes);
+
+  if (is_eof)
+    return NULL;
+
+  editor->line.length = 0;
+  after = editor->capacity - editor->gap_end;
+  if (!reserve(&editor->line, editor->gap_start + after + 1))
+    return NULL;
+  append(&editor->line, editor->text, editor->gap_start);
+  append(&editor->line, editor->text + editor->gap_end, after);
+  editor->line.data[editor->line.length] = '\0';
+  return editor->line.data;
+}
@@ -0,0 +1,21 @@
+/*
+ * line_editor.h
+ * Reads the lines typed (or pasted) by the user, with the terminal in raw mode
+ */
+
+#ifndef LSH_LINE_EDITOR_H
+#define LSH_LINE_EDITOR_H
+
+#include <termios.h>
+
+typedef struct line_editor line_editor;
+
+// The editor restores the given terminal modes whenever it's done with a line
+line_editor *line_editor_new(int input_fd, int output_fd, const struct termios *modes);
+void line_editor_free(line_editor *editor);
+
+// Returns the line (which may consist of many, separated with '\n'), valid until the next call,
+// or NULL at the end of the input
+char *line_editor_read(line_editor *editor, const char *prompt);
+
+#endif
@@ -3,6 +3,9 @@
  * Header file for the shell implementation
  */
 
+#ifndef LSH_H
+#define LSH_H
+
 // Libraries
 #include <stdio.h>
 #include <stdlib.h>
@@ -14,40 +17,25 @@
 #include <fcntl.h>
 #include <termios.h>
 #include <stdbool.h>
+#include <limits.h>
 
 // Internal depedencies
-#import "signal_handlers.c"
-#import "default_functions.c"
+#include "liblsh.h"
+#include "signal_handlers.h"
+#include "server.h"
+#include "line_editor.h"
 
-// Variables
 // Definitions
-#define MAX_ARGS_PER_LINE 256 // Maximum number of tokens to enter in one command
-#define MAX_CHARS_PER_LINE 1024 // Maximum amount of characters to enter by the user
-
-// Shell's PID, PGID and terminal modes
-static pid_t SHELL_PID;
-static pid_t SHELL_PGID;
-static bool SHELL_IS_INTERACTIVE;
-static struct termios SHELL_TERMINAL_MODES;
+#define MAX_HOSTNAME_LENGTH 1024 // Size of the buffer for the hostname shown in the prompt
 
-// Shell's signal handlers
-struct sigaction act_child;
-struct sigaction act_int;
+// Context in which the commands entered by the user are run
+extern lsh_ctx *shell_context;
 
 // Info about current instance of shell
-static char* current_directory;
-bool SHOULD_NOT_REPRINT_PROMPT;
-
-// Current PID
-pid_t pid;
+extern bool SHOULD_NOT_REPRINT_PROMPT;
 
 // Method declarations
-
 void initialize_shell();
-void display_shell_prompt();
-void run_command(char **args, int background);
-void file_input_output_handler(char * args[], char* inputFile, char* outputFile, int option);
-void pipe_handler(char * args[]);
+char *format_shell_prompt();
 
-// Function declarations
-int parse_command(char * args[]);
+#endif
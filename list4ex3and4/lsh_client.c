@@ -0,0 +1,143 @@
+/*
+ * lsh_client.c
+ * lsh-client: runs a command on the resident lsh started with 'lsh --serve SOCKET'
+ *
+ * Usage: lsh-client [-e NAME=value]... SOCKET COMMAND...
+ * The command gets the client's standard input, output, error and working directory,
+ * and the client quits with the command's exit status.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "protocol.h"
+
+#define CLIENT_FAILURE 255 // Exit status used when the command could not be run
+
+/**
+ * Appends the string, together with its' terminator, to the payload
+ */
+static void append(char *payload, size_t *length, const char *string) {
+  size_t string_length = strlen(string) + 1;
+
+  memcpy(payload + *length, string, string_length);
+  *length += string_length;
+}
+
+/**
+ * Sends the header along with the standard input, output and error of the client
+ */
+static int send_header(int server, lsh_request_header *header) {
+  int fds[LSH_PROTOCOL_FD_COUNT] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+  char control[CMSG_SPACE(sizeof(fds))];
+  struct iovec vector = { .iov_base = header, .iov_len = sizeof(*header) };
+  struct msghdr message = {
+    .msg_iov = &vector,
+    .msg_iovlen = 1,
+    .msg_control = control,
+    .msg_controllen = sizeof(control)
+  };
+  struct cmsghdr *control_message;
+  ssize_t count;
+
+  memset(control, 0, sizeof(control));
+  control_message = CMSG_FIRSTHDR(&message);
+  control_message->cmsg_level = SOL_SOCKET;
+  control_message->cmsg_type = SCM_RIGHTS;
+  control_message->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(control_message), fds, sizeof(fds));
+
+  while ((count = sendmsg(server, &message, 0)) == -1 && errno == EINTR);
+  if (count == -1)
+    return -1;
+
+  // The descriptors went with the first byte, the rest of the header is sent normally
+  return write_fully(server, (char *) header + count, sizeof(*header) - count);
+}
+
+int main(int argc, char *argv[]) {
+  struct sockaddr_un address = { .sun_family = AF_UNIX };
+  lsh_request_header header = { .magic = LSH_PROTOCOL_MAGIC };
+  lsh_response response;
+  char directory[PATH_MAX], *payload;
+  size_t length = 0, command_length = 0, environment_length = 0;
+  int server, i, first_argument = 1;
+
+  // Environment overrides come first
+  while (first_argument + 1 < argc && strcmp(argv[first_argument], "-e") == 0) {
+    if (strchr(argv[first_argument + 1], '=') == NULL) {
+      fprintf(stderr, "lsh-client: expected NAME=value and found %s\n", argv[first_argument + 1]);
+      return CLIENT_FAILURE;
+    }
+    environment_length += strlen(argv[first_argument + 1]) + 1;
+    first_argument += 2;
+  }
+
+  if (argc - first_argument < 2) {
+    fprintf(stderr, "usage: lsh-client [-e NAME=value]... SOCKET COMMAND...\n");
+    return CLIENT_FAILURE;
+  }
+
+  if (strlen(argv[first_argument]) >= sizeof(address.sun_path)) {
+    fprintf(stderr, "lsh-client: %s: socket path is too long\n", argv[first_argument]);
+    return CLIENT_FAILURE;
+  }
+  strcpy(address.sun_path, argv[first_argument]);
+
+  if (getcwd(directory, sizeof(directory)) == NULL) {
+    perror("lsh-client");
+    return CLIENT_FAILURE;
+  }
+
+  // The words of the command are joined with spaces, just like the user would type them
+  for (i = first_argument + 1; i < argc; i++)
+    command_length += strlen(argv[i]) + 1;
+
+  header.command_length = command_length;
+  header.environment_length = environment_length;
+  header.directory_length = strlen(directory) + 1;
+
+  if (command_length + environment_length + header.directory_length > LSH_PROTOCOL_MAX_PAYLOAD) {
+    fprintf(stderr, "lsh-client: the command is too long\n");
+    return CLIENT_FAILURE;
+  }
+  if ((payload = malloc(command_length + environment_length + header.directory_length)) == NULL) {
+    fprintf(stderr, "lsh-client: allocation error\n");
+    return CLIENT_FAILURE;
+  }
+
+  for (i = first_argument + 1; i < argc; i++) {
+    memcpy(payload + length, argv[i], strlen(argv[i]));
+    length += strlen(argv[i]);
+    payload[length++] = i < argc - 1 ? ' ' : '\0';
+  }
+  for (i = 2; i < first_argument; i += 2)
+    append(payload, &length, argv[i]);
+  append(payload, &length, directory);
+
+  if ((server = socket(AF_UNIX, SOCK_STREAM, 0)) == -1 || connect(server, (struct sockaddr *) &address, sizeof(address)) == -1) {
+    fprintf(stderr, "lsh-client: %s: %s\n", argv[first_argument], strerror(errno));
+    return CLIENT_FAILURE;
+  }
+
+  if (send_header(server, &header) == -1 || write_fully(server, payload, length) == -1) {
+    perror("lsh-client: unable to send the request");
+    return CLIENT_FAILURE;
+  }
+
+  // Wait for the command to finish
+  if (read_fully(server, &response, sizeof(response)) == -1 || response.magic != LSH_PROTOCOL_MAGIC) {
+    fprintf(stderr, "lsh-client: the server did not run the command\n");
+    return CLIENT_FAILURE;
+  }
+
+  free(payload);
+  close(server);
+  return response.status;
+}
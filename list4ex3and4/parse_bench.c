@@ -0,0 +1,181 @@
+/*
+ * parse_bench.c
+ * Throughput of lsh_parse() alone, without running anything
+ *
+ * usage: parse-bench [-t SECONDS] [FILE...]
+ * Each corpus is parsed over and over for the given time (1 second by default).
+ * The built-in ones are realistic command lines and pathological ones; every FILE
+ * given is an additional corpus, one command line per line.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "parser.h"
+
+#define CLOCK_CHECK_INTERVAL 1024 // Parses between the checks of the time
+
+typedef struct corpus {
+  const char *name;
+  char **lines;
+  int count;
+} corpus;
+
+// Lines typed in everyday use, including the tests from the README
+static const char *realistic_lines[] = {
+  "ls -l > lista.txt",
+  "cat < lista.txt",
+  "ls -l 2> listaerr.txt",
+  "ps aux | grep root | grep 12920 | grep Ss",
+  "sort < in.txt | uniq -c > out.txt",
+  "cd ..",
+  "make -j8",
+  "git log --oneline --graph --all",
+  "find . -name *.c | xargs grep -n TODO | sort | uniq -c | sort -rn | head",
+  "tar c dir |{1M} zstd > dir.tar.zst",
+  "@cpus=0-3 nice=10 io=idle tar c dir | @cpus=4-7 zstd > dir.tar.zst",
+  "timeout 30s curl -s http://localhost:8080/health",
+  "cache sort big.csv | uniq -c > out",
+  "sleep 10 &",
+  "exec 3>>build.log",
+  "make -j8 >&3 2>&1",
+  "   ",
+  "echo done"
+};
+
+static double seconds_since(const struct timespec *start) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void add_line(corpus *target, char *line) {
+  target->lines = realloc(target->lines, (target->count + 1) * sizeof(char *));
+  if (target->lines == NULL || line == NULL) {
+    fprintf(stderr, "parse-bench: allocation error\n");
+    exit(1);
+  }
+  target->lines[target->count++] = line;
+}
+
+/**
+ * Repeats the text until the line is the given length
+ */
+static char *repeat(const char *prefix, const char *text, size_t length) {
+  size_t prefix_length = strlen(prefix), text_length = strlen(text);
+  char *line = malloc(length + 1);
+
+  if (line == NULL)
+    return NULL;
+  memcpy(line, prefix, prefix_length);
+  for (size_t i = prefix_length; i < length; i++)
+    line[i] = text[(i - prefix_length) % text_length];
+  line[length] = '\0';
+  return line;
+}
+
+/**
+ * Lines at the limits of the parser and lines it has to reject
+ */
+static void build_pathological(corpus *target) {
+  add_line(target, repeat("echo", " x", 4 + MAX_ARGS_PER_LINE * 2)); // Too many arguments
+  add_line(target, repeat("echo", " x", 4 + (MAX_ARGS_PER_LINE - 2) * 2)); // Just enough of them
+  add_line(target, repeat("cat", " | cat", 3 + (MAX_COMMANDS_PER_PIPELINE - 1) * 6)); // The longest pipeline
+  add_line(target, repeat("cat", " | cat", 3 + MAX_COMMANDS_PER_PIPELINE * 6)); // Too long
+  add_line(target, repeat("echo ", "a", 65536)); // A 64 KiB word
+  add_line(target, repeat("echo", " \t", 65536)); // Whitespace
+  add_line(target, repeat("cat", " < in", 3 + 200 * 5)); // The same redirection over and over
+  add_line(target, strdup("@cpus=0-1023 nice=19 io=rt:7 deadline=1.5m sort big.csv |{auto} @cpus=0,2,4,6,8,10-20 uniq -c"));
+  add_line(target, strdup("cat <"));
+  add_line(target, strdup("ls | | wc"));
+  add_line(target, strdup("ls & | wc"));
+  add_line(target, strdup("ls |{"));
+  add_line(target, strdup("@cpus=1024 ls"));
+  add_line(target, strdup("timeout"));
+  add_line(target, strdup("timeout -s KILL 5 make")); // The real timeout(1)
+}
+
+static void read_corpus(corpus *target, const char *path) {
+  char *line = NULL;
+  size_t capacity = 0;
+  ssize_t length;
+  FILE *file;
+
+  if ((file = fopen(path, "r")) == NULL) {
+    perror(path);
+    exit(1);
+  }
+  while ((length = getline(&line, &capacity, file)) != -1)
+    add_line(target, strndup(line, length));
+  free(line);
+  fclose(file);
+}
+
+/**
+ * Parses the lines of the corpus over and over, and prints the throughput
+ */
+static void run_corpus(const corpus *target, double duration) {
+  unsigned long long lines = 0, bytes = 0;
+  size_t *lengths = malloc(target->count * sizeof(size_t));
+  struct timespec start;
+  lsh_pipeline pipeline;
+  double elapsed;
+  int errors = 0;
+
+  if (lengths == NULL || target->count == 0)
+    return;
+  for (int i = 0; i < target->count; i++) {
+    lengths[i] = strlen(target->lines[i]);
+    if (lsh_parse(target->lines[i], &pipeline) == LSH_PARSE_ERROR)
+      errors++;
+    lsh_pipeline_free(&pipeline);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  do {
+    for (int i = 0; i < CLOCK_CHECK_INTERVAL; i++) {
+      int index = lines % target->count;
+
+      lsh_parse(target->lines[index], &pipeline);
+      lsh_pipeline_free(&pipeline);
+      bytes += lengths[index];
+      lines++;
+    }
+  } while ((elapsed = seconds_since(&start)) < duration);
+
+  printf("%-14s %6d lines (%d rejected) %12.0f lines/s %10.1f MB/s\n", target->name, target->count, errors, lines / elapsed, bytes / elapsed / 1e6);
+  free(lengths);
+}
+
+int main(int argc, char *argv[]) {
+  corpus realistic = { "realistic" }, pathological = { "pathological" }, file;
+  double duration = 1;
+  int option;
+
+  while ((option = getopt(argc, argv, "t:")) != -1) {
+    if (option != 't' || (duration = atof(optarg)) <= 0) {
+      fprintf(stderr, "usage: parse-bench [-t SECONDS] [FILE...]\n");
+      return 2;
+    }
+  }
+
+  for (size_t i = 0; i < sizeof(realistic_lines) / sizeof(char *); i++)
+    add_line(&realistic, strdup(realistic_lines[i]));
+  build_pathological(&pathological);
+
+  run_corpus(&realistic, duration);
+  run_corpus(&pathological, duration);
+  for (int i = optind; i < argc; i++) {
+    memset(&file, 0, sizeof(file));
+    file.name = argv[i];
+    read_corpus(&file, argv[i]);
+    run_corpus(&file, duration);
+  }
+  return 0;
+}
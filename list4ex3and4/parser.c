@@ -0,0 +1,414 @@
+/*
+ * parser.c
+ * Turns a line entered by the user into a pipeline of commands
+ */
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "parser.h"
+
+#define TOKENS_SEPARATORS " \n\t"
+#define MAX_DURATION_LENGTH 32 // Longer words are not taken for durations
+
+/**
+ * Stores the syntax error in the pipeline and reports the failure
+ */
+static int parse_error(lsh_pipeline *pipeline, const char *error) {
+  pipeline->error = error;
+  return LSH_PARSE_ERROR;
+}
+
+/**
+ * Parses a non-negative decimal number, moving the pointer past it.
+ * Returns -1 if there's no number.
+ */
+static long parse_number(const char **text) {
+  char *end;
+  long value;
+
+  if (**text < '0' || **text > '9')
+    return -1;
+  value = strtol(*text, &end, 10);
+  *text = end;
+  return value;
+}
+
+/**
+ * Parses the size of a pipe's buffer: a number of bytes with an optional K, M or G suffix, or 'auto'
+ */
+bool parse_pipe_size(const char *text, long *size) {
+  long value;
+
+  if (strcmp(text, "auto") == 0) {
+    *size = PIPE_SIZE_AUTO;
+    return true;
+  }
+
+  if ((value = parse_number(&text)) <= 0 || value > INT_MAX)
+    return false;
+
+  switch (*text) {
+    case 'G': case 'g':
+      value *= 1024;
+      // fall through
+    case 'M': case 'm':
+      value *= 1024;
+      // fall through
+    case 'K': case 'k':
+      value *= 1024;
+      text++;
+  }
+
+  if (*text != '\0' || value > INT_MAX)
+    return false;
+  *size = value;
+  return true;
+}
+
+/**
+ * Parses a positive duration: a number with an optional fraction and an ms, s, m, h or d suffix,
+ * eg. 30s, 1.5m or 250ms. Seconds are assumed without the suffix.
+ */
+bool parse_duration(const char *text, long *milliseconds) {
+  double value, unit;
+  char *end;
+
+  if (*text < '0' || *text > '9')
+    return false;
+  value = strtod(text, &end);
+
+  if (strcmp(end, "ms") == 0)
+    unit = 1;
+  else if (*end == '\0' || strcmp(end, "s") == 0)
+    unit = 1000;
+  else if (strcmp(end, "m") == 0)
+    unit = 60 * 1000;
+  else if (strcmp(end, "h") == 0)
+    unit = 60 * 60 * 1000;
+  else if (strcmp(end, "d") == 0)
+    unit = 24 * 60 * 60 * 1000;
+  else
+    return false;
+
+  // Up to a year, anything shorter than a millisecond is rounded up to it
+  value *= unit;
+  if (value <= 0 || value > 366.0 * 24 * 60 * 60 * 1000)
+    return false;
+  *milliseconds = value < 1 ? 1 : (long) value;
+  return true;
+}
+
+/**
+ * Parses the list of CPUs, eg. 0-3,8,10-11
+ */
+static bool parse_cpu_list(const char *text, lsh_launch_modifiers *modifiers) {
+  long first, last;
+
+  memset(modifiers->cpus, 0, sizeof(modifiers->cpus));
+  while (true) {
+    if ((first = last = parse_number(&text)) == -1)
+      return false;
+    if (*text == '-') {
+      text++;
+      if ((last = parse_number(&text)) == -1)
+        return false;
+    }
+    if (first > last || last >= MAX_CPUS)
+      return false;
+
+    for (long cpu = first; cpu <= last; cpu++)
+      modifiers->cpus[cpu / 8] |= 1 << (cpu % 8);
+
+    if (*text == '\0')
+      return true;
+    if (*text++ != ',')
+      return false;
+  }
+}
+
+/**
+ * Parses the I/O scheduling class with an optional level, eg. idle, be:4, rt:0
+ */
+static bool parse_io_class(const char *text, lsh_launch_modifiers *modifiers) {
+  const char *level = strchr(text, ':');
+  size_t length = level != NULL ? (size_t) (level - text) : strlen(text);
+
+  if (length == 4 && strncmp(text, "idle", 4) == 0 && level == NULL) {
+    modifiers->io_class = IOPRIO_CLASS_IDLE;
+    modifiers->io_level = 0;
+    return true;
+  }
+
+  if (length == 2 && strncmp(text, "rt", 2) == 0)
+    modifiers->io_class = IOPRIO_CLASS_RT;
+  else if (length == 2 && strncmp(text, "be", 2) == 0)
+    modifiers->io_class = IOPRIO_CLASS_BE;
+  else
+    return false;
+
+  // The levels go from 0 (highest priority) to 7, 4 is the kernel's default
+  modifiers->io_level = 4;
+  if (level != NULL) {
+    level++;
+    if ((modifiers->io_level = parse_number(&level)) == -1 || *level != '\0' || modifiers->io_level > 7)
+      return false;
+  }
+  return true;
+}
+
+/**
+ * Recognizes the launch modifiers at the beginning of the command. marked tells whether the token
+ * started with '@', which the caller strips.
+ * Returns 1 if the token was a modifier, 0 if it's a regular word and -1 on error.
+ */
+static int parse_launch_modifier(lsh_pipeline *pipeline, lsh_command *command, const char *token, bool marked) {
+  lsh_launch_modifiers *modifiers = &command->modifiers;
+  bool has_any = modifiers->has_cpus || modifiers->has_nice || modifiers->has_io || modifiers->has_deadline;
+  const char *value;
+  char *end;
+
+  // Modifiers have to come before the name of the command
+  if (command->argc > 0)
+    return 0;
+  if (!marked && !has_any)
+    return 0;
+
+  if (strncmp(token, "cpus=", 5) == 0) {
+    if (!parse_cpu_list(token + 5, modifiers)) {
+      parse_error(pipeline, "invalid list of CPUs in the cpus= modifier");
+      return -1;
+    }
+    modifiers->has_cpus = true;
+  }
+  else if (strncmp(token, "nice=", 5) == 0) {
+    value = token + 5;
+    modifiers->nice = strtol(value, &end, 10);
+    if (*value == '\0' || *end != '\0' || modifiers->nice < -20 || modifiers->nice > 19) {
+      parse_error(pipeline, "the nice= modifier expects a number from -20 to 19");
+      return -1;
+    }
+    modifiers->has_nice = true;
+  }
+  else if (strncmp(token, "io=", 3) == 0) {
+    if (!parse_io_class(token + 3, modifiers)) {
+      parse_error(pipeline, "the io= modifier expects idle, be[:0-7] or rt[:0-7]");
+      return -1;
+    }
+    modifiers->has_io = true;
+  }
+  else if (strncmp(token, "deadline=", 9) == 0) {
+    if (!parse_duration(token + 9, &modifiers->deadline)) {
+      parse_error(pipeline, "the deadline= modifier expects a duration, eg. 30s, 1.5m or 250ms");
+      return -1;
+    }
+    modifiers->has_deadline = true;
+  }
+  else if (marked) {
+    parse_error(pipeline, "unknown launch modifier, expected cpus=, nice=, io= or deadline=");
+    return -1;
+  }
+  else {
+    // A regular word following the modifiers, eg. the name of the command
+    return 0;
+  }
+
+  return 1;
+}
+
+/**
+ * Recognizes the redirections of numbered descriptors: [N]<, [N]> and [N]>>, followed by the name of the file
+ * either in the same token (eg. 3>>log) or in the next one (3>> log), [N]>&M, [N]<&M and [N]>&-.
+ * Returns one of LSH_REDIRECTION_*.
+ */
+int parse_redirection(const char *token, lsh_redirection *redirection) {
+  const char *operator = token, *file;
+
+  redirection->fd = -1;
+  if (*operator >= '0' && *operator <= '0' + MAX_REDIRECTED_FD)
+    redirection->fd = *operator++ - '0';
+  if (*operator != '<' && *operator != '>')
+    return LSH_REDIRECTION_NONE;
+  if (redirection->fd == -1)
+    redirection->fd = *operator == '<' ? 0 : 1;
+
+  if (operator[1] == '&') {
+    if (operator[2] == '\0' || operator[3] != '\0')
+      return LSH_REDIRECTION_NONE;
+    if (operator[2] == '-') {
+      redirection->kind = LSH_REDIRECT_CLOSE;
+      return LSH_REDIRECTION_COMPLETE;
+    }
+    if (operator[2] < '0' || operator[2] > '0' + MAX_REDIRECTED_FD)
+      return LSH_REDIRECTION_NONE;
+    redirection->kind = LSH_REDIRECT_DUPLICATE;
+    redirection->source_fd = operator[2] - '0';
+    return LSH_REDIRECTION_COMPLETE;
+  }
+
+  if (*operator == '>' && operator[1] == '>') {
+    redirection->kind = LSH_REDIRECT_APPEND;
+    file = operator + 2;
+  }
+  else {
+    redirection->kind = *operator == '<' ? LSH_REDIRECT_READ : LSH_REDIRECT_WRITE;
+    file = operator + 1;
+  }
+
+  // Anything else made of '<' and '>' (eg. <<EOF) is left alone
+  if (*file == '<' || *file == '>')
+    return LSH_REDIRECTION_NONE;
+  if (*file == '\0') {
+    redirection->file = NULL;
+    return LSH_REDIRECTION_FILE;
+  }
+  // The file name is a part of the token, which lives in the caller's buffer
+  redirection->file = (char *) file;
+  return LSH_REDIRECTION_COMPLETE;
+}
+
+/**
+ * Tells whether the next token, which strtok_r() hasn't split off yet, is a duration.
+ * rest is what strtok_r() left in saveptr, the buffer isn't modified.
+ */
+static bool is_duration_next(const char *rest) {
+  char word[MAX_DURATION_LENGTH];
+  long milliseconds;
+  size_t length;
+
+  if (rest == NULL)
+    return false;
+  rest += strspn(rest, TOKENS_SEPARATORS);
+  if ((length = strcspn(rest, TOKENS_SEPARATORS)) == 0 || length >= sizeof(word))
+    return false;
+  memcpy(word, rest, length);
+  word[length] = '\0';
+  return parse_duration(word, &milliseconds);
+}
+
+/**
+ * Splits the line into tokens and groups them into commands.
+ * The tokens have to be separated by whitespace, eg. ls -l | grep lsh > out.txt
+ * The pipeline has to be released with lsh_pipeline_free() afterwards.
+ */
+int lsh_parse(const char *line, lsh_pipeline *pipeline) {
+  char *token, *saveptr, *end;
+  char **target;
+  lsh_command *command;
+  lsh_redirection redirection;
+  int word_count = 0, redirection_type;
+  bool is_command_start;
+
+  memset(pipeline, 0, sizeof(*pipeline));
+
+  if ((pipeline->buffer = strdup(line)) == NULL)
+    return parse_error(pipeline, "out of memory");
+
+  command = &pipeline->commands[0];
+  command->argv = &pipeline->words[0];
+  pipeline->command_count = 1;
+
+  for (token = strtok_r(pipeline->buffer, TOKENS_SEPARATORS, &saveptr); token != NULL; token = strtok_r(NULL, TOKENS_SEPARATORS, &saveptr)) {
+    if (pipeline->is_background)
+      return parse_error(pipeline, "'&' has to be the last token of the command");
+
+    if (strcmp(token, "&") == 0) {
+      pipeline->is_background = true;
+      continue;
+    }
+
+    if (token[0] == '|') {
+      // Terminate the current command and start the next one
+      if (command->argc == 0)
+        return parse_error(pipeline, "missing command before '|'");
+
+      // '|{SIZE}' sets the buffer size of the pipe, eg. |{1M}
+      if (token[1] == '{') {
+        end = strchr(token, '}');
+        if (end == NULL || end[1] != '\0')
+          return parse_error(pipeline, "expected '|{SIZE}'");
+        *end = '\0';
+        if (!parse_pipe_size(token + 2, &command->pipe_size))
+          return parse_error(pipeline, "the pipe size has to be a number with an optional K, M or G suffix, or 'auto'");
+      }
+      else if (token[1] != '\0') {
+        return parse_error(pipeline, "expected '|' or '|{SIZE}'");
+      }
+
+      if (pipeline->command_count == MAX_COMMANDS_PER_PIPELINE)
+        return parse_error(pipeline, "too many commands in the pipeline");
+
+      pipeline->words[word_count++] = NULL;
+      command = &pipeline->commands[pipeline->command_count++];
+      command->argv = &pipeline->words[word_count];
+      continue;
+    }
+
+    // Redirections consume the token that follows them
+    target = NULL;
+    if (strcmp(token, "<") == 0)
+      target = &command->input_file;
+    else if (strcmp(token, ">") == 0)
+      target = &command->output_file;
+    else if (strcmp(token, "2>") == 0)
+      target = &command->error_file;
+
+    if (target != NULL) {
+      if ((*target = strtok_r(NULL, TOKENS_SEPARATORS, &saveptr)) == NULL)
+        return parse_error(pipeline, "not enough input arguments for I/O redirection");
+      continue;
+    }
+
+    // The other ones, eg. >> log, 3>>log, 2>&1 or 3>&-
+    if ((redirection_type = parse_redirection(token, &redirection)) != LSH_REDIRECTION_NONE) {
+      if (command->redirection_count == MAX_REDIRECTIONS)
+        return parse_error(pipeline, "too many redirections");
+      if (redirection_type == LSH_REDIRECTION_FILE && (redirection.file = strtok_r(NULL, TOKENS_SEPARATORS, &saveptr)) == NULL)
+        return parse_error(pipeline, "not enough input arguments for I/O redirection");
+      command->redirections[command->redirection_count++] = redirection;
+      continue;
+    }
+
+    // 'timeout DURATION COMMAND...' sets the deadline, without an extra timeout(1) process.
+    // It may follow the 'cache' prefix, and with any options (eg. timeout -s KILL 5 make) it's the real program.
+    is_command_start = command->argc == 0 || (pipeline->command_count == 1 && command->argc == 1 && strcmp(command->argv[0], "cache") == 0);
+    if (is_command_start && strcmp(token, "timeout") == 0 && is_duration_next(saveptr)) {
+      parse_duration(strtok_r(NULL, TOKENS_SEPARATORS, &saveptr), &command->modifiers.deadline);
+      command->modifiers.has_deadline = true;
+      continue;
+    }
+
+    // Launch modifiers, eg. @cpus=0-3 nice=10
+    switch (parse_launch_modifier(pipeline, command, token[0] == '@' ? token + 1 : token, token[0] == '@')) {
+      case 1:
+        continue;
+      case -1:
+        return LSH_PARSE_ERROR;
+    }
+
+    // Leave room for the NULL terminators of the remaining commands
+    if (word_count >= MAX_ARGS_PER_LINE)
+      return parse_error(pipeline, "too many arguments");
+
+    pipeline->words[word_count++] = token;
+    command->argc++;
+  }
+  pipeline->words[word_count] = NULL;
+
+  if (command->argc == 0) {
+    if (pipeline->command_count == 1 && !pipeline->is_background && command->input_file == NULL && command->output_file == NULL && command->error_file == NULL && command->redirection_count == 0 && !command->modifiers.has_cpus && !command->modifiers.has_nice && !command->modifiers.has_io && !command->modifiers.has_deadline)
+      return LSH_PARSE_EMPTY;
+    return parse_error(pipeline, "missing command");
+  }
+
+  return LSH_PARSE_OK;
+}
+
+/**
+ * Releases the memory held by the parsed pipeline
+ */
+void lsh_pipeline_free(lsh_pipeline *pipeline) {
+  free(pipeline->buffer);
+  pipeline->buffer = NULL;
+}
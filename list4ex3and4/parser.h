@@ -0,0 +1,105 @@
+/*
+ * parser.h
+ * Turns a line entered by the user into a pipeline of commands
+ */
+
+#ifndef LSH_PARSER_H
+#define LSH_PARSER_H
+
+#include <stdbool.h>
+
+// Definitions
+#define MAX_ARGS_PER_LINE 256 // Maximum number of tokens to enter in one command
+#define MAX_COMMANDS_PER_PIPELINE 64 // Maximum number of commands separated by '|'
+#define MAX_CPUS 1024 // Highest CPU number accepted by the cpus= modifier, plus one
+#define MAX_REDIRECTIONS 8 // Redirections of numbered descriptors per command, eg. 3>>log 2>&1
+#define MAX_REDIRECTED_FD 9 // Highest descriptor number a redirection may name
+
+// I/O scheduling classes of the io= modifier, as understood by ioprio_set()
+#define IOPRIO_CLASS_RT 1
+#define IOPRIO_CLASS_BE 2
+#define IOPRIO_CLASS_IDLE 3
+
+// Special values of lsh_command.pipe_size
+#define PIPE_SIZE_DEFAULT 0 // The kernel's default, unless LSH_PIPE_SIZE says otherwise
+#define PIPE_SIZE_AUTO -1 // Grown by the shell whenever the writer stalls
+
+/*
+ * Scheduling attributes applied to the command before it's executed,
+ * eg. @cpus=0-3 nice=10 io=idle sort big.csv
+ * The first modifier of the command is marked with '@', the ones right after it may leave it out.
+ * 'timeout DURATION' in front of the command is the same as the deadline= modifier.
+ */
+typedef struct lsh_launch_modifiers {
+  bool has_cpus;
+  unsigned char cpus[MAX_CPUS / 8]; // cpus=0-3,8 - bitmask of the allowed CPUs
+  bool has_nice;
+  int nice; // nice=10
+  bool has_io;
+  int io_class; // io=idle, io=be:4, io=rt:0
+  int io_level;
+  bool has_deadline;
+  long deadline; // deadline=30s, in milliseconds - the whole pipeline is stopped once it's exceeded
+} lsh_launch_modifiers;
+
+// Kinds of lsh_redirection
+#define LSH_REDIRECT_READ 0 // N<file
+#define LSH_REDIRECT_WRITE 1 // N>file
+#define LSH_REDIRECT_APPEND 2 // N>>file
+#define LSH_REDIRECT_DUPLICATE 3 // N>&M or N<&M
+#define LSH_REDIRECT_CLOSE 4 // N>&- or N<&-
+
+// Return values of parse_redirection()
+#define LSH_REDIRECTION_NONE 0 // The token is not a redirection
+#define LSH_REDIRECTION_FILE 1 // The next token is the name of the file
+#define LSH_REDIRECTION_COMPLETE 2 // Nothing follows, or the name of the file is the rest of the token, eg. 3>>log
+
+/*
+ * Redirection of a numbered descriptor, eg. >>log (1 is the default for '>', 0 for '<'), 3>&1 or 3>&-
+ */
+typedef struct lsh_redirection {
+  int fd;
+  int kind;
+  char *file; // READ, WRITE and APPEND
+  int source_fd; // DUPLICATE
+} lsh_redirection;
+
+/*
+ * A single command of a pipeline, together with its' redirections
+ */
+typedef struct lsh_command {
+  char **argv; // NULL-terminated, points into lsh_pipeline.words
+  int argc;
+  char *input_file; // '<'
+  char *output_file; // '>'
+  char *error_file; // '2>'
+  lsh_redirection redirections[MAX_REDIRECTIONS]; // The rest of them, applied after the three above in the given order
+  int redirection_count;
+  long pipe_size; // Buffer of the pipe to the next command, set with '|{1M}' or '|{auto}'
+  lsh_launch_modifiers modifiers;
+} lsh_command;
+
+/*
+ * Parsed form of one line: commands connected with pipes
+ */
+typedef struct lsh_pipeline {
+  char *buffer; // Private copy of the line, tokenized in place
+  char *words[MAX_ARGS_PER_LINE + MAX_COMMANDS_PER_PIPELINE];
+  lsh_command commands[MAX_COMMANDS_PER_PIPELINE];
+  int command_count;
+  bool is_background; // '&' at the end of the line
+  const char *error; // Description of the syntax error, if any
+} lsh_pipeline;
+
+// Return values of lsh_parse()
+#define LSH_PARSE_OK 0
+#define LSH_PARSE_EMPTY 1 // Nothing but whitespace was entered
+#define LSH_PARSE_ERROR -1 // Syntax error, see lsh_pipeline.error
+
+int lsh_parse(const char *line, lsh_pipeline *pipeline);
+bool parse_pipe_size(const char *text, long *size);
+int parse_redirection(const char *token, lsh_redirection *redirection);
+bool parse_duration(const char *text, long *milliseconds);
+void lsh_pipeline_free(lsh_pipeline *pipeline);
+
+#endif
@@ -0,0 +1,60 @@
+/*
+ * pipe_tuning.c
+ * Sizes the buffers of the pipes connecting the commands of a pipeline
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "pipe_tuning.h"
+
+#define DEFAULT_MAXIMUM_PIPE_SIZE 1048576 // The kernel's default for /proc/sys/fs/pipe-max-size
+
+/**
+ * Returns the largest buffer an unprivileged process may give to a pipe
+ */
+long maximum_pipe_size(void) {
+  FILE *file = fopen("/proc/sys/fs/pipe-max-size", "re");
+  long size = DEFAULT_MAXIMUM_PIPE_SIZE;
+
+  if (file != NULL) {
+    if (fscanf(file, "%ld", &size) != 1)
+      size = DEFAULT_MAXIMUM_PIPE_SIZE;
+    fclose(file);
+  }
+  return size;
+}
+
+/**
+ * Sets the size of the pipe's buffer.
+ * Sizes above /proc/sys/fs/pipe-max-size are cut down to it.
+ */
+void set_pipe_size(int pipe_fd, long size) {
+  if (fcntl(pipe_fd, F_SETPIPE_SZ, (int) size) == -1 && errno == EPERM)
+    fcntl(pipe_fd, F_SETPIPE_SZ, (int) maximum_pipe_size());
+}
+
+/**
+ * Doubles the buffers of the pipes which are full, which means that their writers are stalled.
+ * monitors[] holds the read ends of the pipes kept by the shell, -1 for the pipes not monitored anymore.
+ */
+void grow_stalled_pipes(int monitors[], int count, long maximum_size) {
+  int queued, capacity;
+
+  for (int i = 0; i < count; i++) {
+    if (monitors[i] == -1)
+      continue;
+
+    if ((capacity = fcntl(monitors[i], F_GETPIPE_SZ)) == -1 || capacity >= maximum_size)
+      continue;
+    if (ioctl(monitors[i], FIONREAD, &queued) == -1 || queued < capacity)
+      continue;
+
+    fcntl(monitors[i], F_SETPIPE_SZ, (int) (capacity * 2 < maximum_size ? capacity * 2 : maximum_size));
+  }
+}
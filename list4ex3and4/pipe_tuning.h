@@ -0,0 +1,16 @@
+/*
+ * pipe_tuning.h
+ * Sizes the buffers of the pipes connecting the commands of a pipeline
+ */
+
+#ifndef LSH_PIPE_TUNING_H
+#define LSH_PIPE_TUNING_H
+
+// Definitions
+#define PIPE_MONITOR_INTERVAL_MS 10 // How often the adaptive pipes are checked for stalled writers
+
+long maximum_pipe_size(void);
+void set_pipe_size(int pipe_fd, long size);
+void grow_stalled_pipes(int monitors[], int count, long maximum_size);
+
+#endif
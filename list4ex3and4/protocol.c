@@ -0,0 +1,51 @@
+/*
+ * protocol.c
+ * Messages exchanged between lsh-client and lsh running in the command-server mode
+ */
+
+#include <errno.h>
+#include <unistd.h>
+
+#include "protocol.h"
+
+/**
+ * Reads exactly length bytes.
+ * Returns 0 on success, -1 on error or if the peer closed the connection.
+ */
+int read_fully(int fd, void *buffer, size_t length) {
+  char *position = buffer;
+  ssize_t count;
+
+  while (length > 0) {
+    if ((count = read(fd, position, length)) == -1) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    if (count == 0)
+      return -1;
+    position += count;
+    length -= count;
+  }
+  return 0;
+}
+
+/**
+ * Writes exactly length bytes.
+ * Returns 0 on success, -1 on error.
+ */
+int write_fully(int fd, const void *buffer, size_t length) {
+  const char *position = buffer;
+  ssize_t count;
+
+  while (length > 0) {
+    if ((count = write(fd, position, length)) == -1) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    position += count;
+    length -= count;
+  }
+  return 0;
+}
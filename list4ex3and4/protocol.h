@@ -0,0 +1,39 @@
+/*
+ * protocol.h
+ * Messages exchanged between lsh-client and lsh running in the command-server mode
+ *
+ * The client sends the request header together with its' standard input,
+ * output and error (SCM_RIGHTS), followed by the command line, the environment
+ * overrides and the working directory. Every string is terminated with '\0'
+ * and the lengths include the terminators.
+ * The server runs the command on the passed descriptors and answers with the response.
+ */
+
+#ifndef LSH_PROTOCOL_H
+#define LSH_PROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Definitions
+#define LSH_PROTOCOL_MAGIC 0x6c736831 // "lsh1"
+#define LSH_PROTOCOL_MAX_PAYLOAD (1 << 20) // Maximum size of the command, environment and directory together
+#define LSH_PROTOCOL_FD_COUNT 3 // Standard input, output and error
+
+typedef struct lsh_request_header {
+  uint32_t magic;
+  uint32_t command_length;
+  uint32_t environment_length;
+  uint32_t directory_length;
+} lsh_request_header;
+
+typedef struct lsh_response {
+  uint32_t magic;
+  int32_t status; // Exit status of the command
+} lsh_response;
+
+// Helpers retrying the partial reads and writes
+int read_fully(int fd, void *buffer, size_t length);
+int write_fully(int fd, const void *buffer, size_t length);
+
+#endif
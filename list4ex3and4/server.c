@@ -0,0 +1,216 @@
+/*
+ * server.c
+ * Command-server mode: a resident lsh accepts requests over a Unix domain socket
+ * and runs each of them in its' own context, on a separate thread
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "liblsh.h"
+#include "protocol.h"
+#include "server.h"
+
+// Limits the number of requests run at the same time
+static sem_t request_slots;
+
+/**
+ * Receives the request header together with the passed descriptors.
+ * The descriptors which were not passed are set to /dev/null.
+ * Returns 0 on success.
+ */
+static int receive_header(int client, lsh_request_header *header, int fds[LSH_PROTOCOL_FD_COUNT]) {
+  char control[CMSG_SPACE(LSH_PROTOCOL_FD_COUNT * sizeof(int))];
+  struct iovec vector = { .iov_base = header, .iov_len = sizeof(*header) };
+  struct msghdr message = {
+    .msg_iov = &vector,
+    .msg_iovlen = 1,
+    .msg_control = control,
+    .msg_controllen = sizeof(control)
+  };
+  struct cmsghdr *control_message;
+  ssize_t count;
+  int passed = 0;
+
+  // MSG_CMSG_CLOEXEC keeps the descriptors from leaking into the commands of other requests
+  while ((count = recvmsg(client, &message, MSG_CMSG_CLOEXEC)) == -1 && errno == EINTR);
+  if (count <= 0)
+    return -1;
+
+  for (control_message = CMSG_FIRSTHDR(&message); control_message != NULL; control_message = CMSG_NXTHDR(&message, control_message)) {
+    if (control_message->cmsg_level == SOL_SOCKET && control_message->cmsg_type == SCM_RIGHTS) {
+      passed = (control_message->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      memcpy(fds, CMSG_DATA(control_message), passed * sizeof(int));
+    }
+  }
+  for (int i = passed; i < LSH_PROTOCOL_FD_COUNT; i++)
+    fds[i] = open("/dev/null", O_RDWR | O_CLOEXEC);
+
+  // The rest of the header may come in the following segments
+  if ((size_t) count < sizeof(*header) && read_fully(client, (char *) header + count, sizeof(*header) - count) == -1)
+    return -1;
+
+  return 0;
+}
+
+/**
+ * Runs a single request and sends back the exit status of the command
+ */
+static void *handle_request(void *argument) {
+  int client = (int) (intptr_t) argument;
+  int fds[LSH_PROTOCOL_FD_COUNT] = { -1, -1, -1 };
+  lsh_request_header header;
+  lsh_response response = { .magic = LSH_PROTOCOL_MAGIC };
+  char *payload = NULL, *command, *environment, *directory, *entry, *separator;
+  size_t payload_length;
+  lsh_ctx *ctx = NULL;
+
+  if (receive_header(client, &header, fds) == -1 || header.magic != LSH_PROTOCOL_MAGIC)
+    goto cleanup;
+
+  payload_length = (size_t) header.command_length + header.environment_length + header.directory_length;
+  if (payload_length > LSH_PROTOCOL_MAX_PAYLOAD || (payload = malloc(payload_length + 1)) == NULL)
+    goto cleanup;
+  if (read_fully(client, payload, payload_length) == -1)
+    goto cleanup;
+  payload[payload_length] = '\0';
+
+  command = payload;
+  environment = command + header.command_length;
+  directory = environment + header.environment_length;
+
+  // Every string of the payload has to be terminated
+  if (header.command_length == 0 || command[header.command_length - 1] != '\0')
+    goto cleanup;
+  if (header.environment_length > 0 && environment[header.environment_length - 1] != '\0')
+    goto cleanup;
+  if (header.directory_length > 0 && directory[header.directory_length - 1] != '\0')
+    goto cleanup;
+
+  if ((ctx = lsh_ctx_new()) == NULL)
+    goto cleanup;
+
+  lsh_set_stdio(ctx, fds[0], fds[1], fds[2]);
+
+  // Environment overrides
+  for (entry = environment; entry < directory; entry += strlen(entry) + 1) {
+    if ((separator = strchr(entry, '=')) == NULL)
+      continue;
+    *separator = '\0';
+    // The leak check counts the descriptors of the whole process, which the other requests open and close
+    if (strcmp(entry, "LSH_CHECK_FDS") != 0)
+      lsh_setenv(ctx, entry, separator + 1);
+  }
+
+  // The command runs in the directory of the client
+  if (header.directory_length > 0 && lsh_chdir(ctx, directory) != 0)
+    response.status = 1;
+  else
+    response.status = lsh_eval(ctx, command);
+
+  write_fully(client, &response, sizeof(response));
+
+cleanup:
+  close(client);
+  for (int i = 0; i < LSH_PROTOCOL_FD_COUNT; i++) {
+    if (fds[i] != -1)
+      close(fds[i]);
+  }
+  free(payload);
+
+  // Background commands of the request keep its' slot until they finish
+  if (ctx != NULL) {
+    lsh_wait_background(ctx);
+    lsh_ctx_free(ctx);
+  }
+  sem_post(&request_slots);
+  return NULL;
+}
+
+/**
+ * Listens on the socket and runs the incoming requests,
+ * at most max_concurrent_requests at the same time.
+ * Returns only if the socket cannot be set up.
+ */
+int serve_commands(const char *socket_path, int max_concurrent_requests) {
+  struct sockaddr_un address = { .sun_family = AF_UNIX };
+  pthread_attr_t attributes;
+  struct timeval request_timeout = { .tv_sec = REQUEST_TIMEOUT_SECONDS };
+  pthread_t thread;
+  int server, client;
+  mode_t previous_umask;
+
+  if (strlen(socket_path) >= sizeof(address.sun_path)) {
+    fprintf(stderr, "lsh: %s: socket path is too long\n", socket_path);
+    return EXIT_FAILURE;
+  }
+  strcpy(address.sun_path, socket_path);
+
+  // The clients may disconnect before receiving the response
+  signal(SIGPIPE, SIG_IGN);
+
+  // See handle_request()
+  unsetenv("LSH_CHECK_FDS");
+
+  if ((server = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1) {
+    perror("lsh: socket");
+    return EXIT_FAILURE;
+  }
+
+  // Replace the socket left behind by the previous server. It's created accessible to the user only,
+  // with no window in which the others could connect.
+  unlink(socket_path);
+  previous_umask = umask(077);
+  if (bind(server, (struct sockaddr *) &address, sizeof(address)) == -1) {
+    perror("lsh: socket");
+    umask(previous_umask);
+    close(server);
+    return EXIT_FAILURE;
+  }
+  umask(previous_umask);
+  if (listen(server, SOMAXCONN) == -1) {
+    perror("lsh: socket");
+    close(server);
+    return EXIT_FAILURE;
+  }
+
+  sem_init(&request_slots, 0, max_concurrent_requests);
+  pthread_attr_init(&attributes);
+  pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+
+  while (true) {
+    // Wait for a free slot before accepting, so that the waiting clients queue up in the backlog
+    while (sem_wait(&request_slots) == -1 && errno == EINTR);
+
+    if ((client = accept4(server, NULL, NULL, SOCK_CLOEXEC)) == -1) {
+      if (errno != EINTR)
+        perror("lsh: accept");
+      sem_post(&request_slots);
+      continue;
+    }
+
+    // A client which connects and sends nothing would hold its' slot forever
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &request_timeout, sizeof(request_timeout));
+
+    if (pthread_create(&thread, &attributes, handle_request, (void *) (intptr_t) client) != 0) {
+      fprintf(stderr, "lsh: unable to create the request's thread\n");
+      close(client);
+      sem_post(&request_slots);
+    }
+  }
+}
@@ -0,0 +1,15 @@
+/*
+ * server.h
+ * Command-server mode: a resident lsh running the commands sent by lsh-client
+ */
+
+#ifndef LSH_SERVER_H
+#define LSH_SERVER_H
+
+// Definitions
+#define DEFAULT_MAX_CONCURRENT_REQUESTS 16 // Requests run at the same time, unless set with --max-requests
+#define REQUEST_TIMEOUT_SECONDS 5 // How long the server waits for each part of a request before dropping the client
+
+int serve_commands(const char *socket_path, int max_concurrent_requests);
+
+#endif
@@ -0,0 +1,26 @@
+/*
+ * sha256.h
+ * SHA-256, used to address the entries and outputs of the command cache
+ */
+
+#ifndef LSH_SHA256_H
+#define LSH_SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_DIGEST_SIZE 32
+#define SHA256_HEX_SIZE (SHA256_DIGEST_SIZE * 2 + 1) // Hexadecimal form, with the terminator
+
+typedef struct sha256_ctx {
+  uint32_t state[8];
+  uint64_t length; // Bytes hashed so far
+  unsigned char block[64];
+  size_t block_length;
+} sha256_ctx;
+
+void sha256_init(sha256_ctx *ctx);
+void sha256_update(sha256_ctx *ctx, const void *data, size_t length);
+void sha256_final_hex(sha256_ctx *ctx, char hex[SHA256_HEX_SIZE]);
+
+#endif
@@ -3,31 +3,46 @@
  * Configure the actions invoked upon the signal being sent to the shell.
  */
 
-#include "signal_handlers.h"
+#include "lsh.h"
 
 /*
  * SIGCHILD signal handler
+ * Cleans up the background processes of the shell which have finished, without printing
+ * anything over the line being edited. The foreground ones are waited for by lsh_eval() itself.
  */
-void sigchild_signal_handler(int p) {
+void sigchild_reap_handler(int p) {
+  lsh_reap(shell_context);
+}
 
-    // Go into a loop to make sure that there are no more children which need to be handled.
-    // WNOHANG (non-blocking call) makes sure that there are no problems if the child is cleaned up elsewhere.
-    while (waitpid(-1, NULL, WNOHANG) > 0) {
-      // printf("child %d terminated\n", pid);
-    }
-    printf("\n");
+/*
+ * SIGINT, SIGQUIT and SIGTERM signal handler of the script mode
+ * The running pipeline is in a process group of its' own, so it's stopped together with the script.
+ */
+void script_signal_handler(int p) {
+  pid_t group = lsh_foreground_group(shell_context);
+
+  if (group > 0)
+    killpg(group, p);
+  signal(p, SIG_DFL);
+  raise(p);
 }
 
 /*
- * SIGINT signal handler
+ * SIGINT, SIGQUIT and SIGTSTP signal handler
+ * The terminal sends them straight to the foreground pipeline, so the shell only gets them
+ * while it's at the prompt, or when they're sent to the shell itself with kill.
  */
-void sigint_signal_handler(int p) {
+void job_control_signal_handler(int p) {
+  pid_t group = lsh_foreground_group(shell_context);
 
-  // Send the SIGTERM signal to the child process
-  if (kill(pid, SIGTERM) == 0) {
-    printf("\nlsh: process %d received a SIGINT signal\n", pid);
+  // Pass the signal on to every command of the foreground pipeline, including the builtins the shell runs itself
+  if (lsh_interrupt(shell_context, p)) {
+    if (group > 0)
+      printf("\nlsh: process group %d received a %s signal\n", group, p == SIGINT ? "SIGINT" : p == SIGQUIT ? "SIGQUIT" : "SIGTSTP");
+    else
+      printf("\n");
     SHOULD_NOT_REPRINT_PROMPT = true;
   }
-  else
+  else if (p == SIGINT)
     printf("\n");
 }
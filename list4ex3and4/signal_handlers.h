@@ -3,8 +3,12 @@
  * Configure the actions invoked upon the signal being sent to the shell.
  */
 
-#include "lsh.h"
+#ifndef LSH_SIGNAL_HANDLERS_H
+#define LSH_SIGNAL_HANDLERS_H
 
 // Declares signal handlers
-void sigchild_signal_handler(int p); // SIGCHILD signal handler
-void sigint_signal_handler(int p); // SIGINT signal handler
+void sigchild_reap_handler(int p); // SIGCHILD signal handler
+void script_signal_handler(int p); // SIGINT, SIGQUIT and SIGTERM signal handler of the script mode
+void job_control_signal_handler(int p); // SIGINT, SIGQUIT and SIGTSTP signal handler
+
+#endif
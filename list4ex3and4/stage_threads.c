@@ -0,0 +1,140 @@
+/*
+ * stage_threads.c
+ * Runs the built-in functions which are a part of a pipeline on threads of the shell,
+ * reading and writing the pipes directly, so that no process has to be forked for them
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "descriptors.h"
+#include "stage_threads.h"
+
+// Everything the thread needs; it owns the descriptors and frees the state when it's done
+typedef struct stage_thread {
+  lsh_ctx *ctx;
+  lsh_builtin builtin;
+  int fds[3];
+  char **argv;
+} stage_thread;
+
+/**
+ * Copies the arguments into a single block, so that the thread doesn't depend on the parsed line
+ */
+static char **copy_arguments(char *argv[]) {
+  size_t size = sizeof(char *);
+  int count = 0;
+  char **copy, *text;
+
+  for (; argv[count] != NULL; count++)
+    size += sizeof(char *) + strlen(argv[count]) + 1;
+  if ((copy = malloc(size)) == NULL)
+    return NULL;
+
+  text = (char *) (copy + count + 1);
+  for (int i = 0; i < count; i++) {
+    copy[i] = strcpy(text, argv[i]);
+    text += strlen(argv[i]) + 1;
+  }
+  copy[count] = NULL;
+  return copy;
+}
+
+static void free_stage(stage_thread *stage) {
+  for (int stream = 0; stream < 3; stream++) {
+    if (stage->fds[stream] != -1)
+      close(stage->fds[stream]);
+  }
+  free(stage->argv);
+  free(stage);
+}
+
+static void *run_stage_thread(void *argument) {
+  stage_thread *stage = argument;
+  lsh_ctx *ctx = stage->ctx;
+  int status;
+
+  for (int stream = 0; stream < 3; stream++)
+    lsh_stage_fds[stream] = stage->fds[stream];
+  status = stage->builtin(stage->ctx, stage->argv);
+  for (int stream = 0; stream < 3; stream++)
+    lsh_stage_fds[stream] = -1;
+
+  // Closing the output lets the next command see the end of its' input
+  free_stage(stage);
+  lsh_ctx_release(ctx);
+  return (void *) (intptr_t) status;
+}
+
+/**
+ * Starts the built-in function on a thread, with its' own copies of the descriptors.
+ * Redirections are applied right away, in the calling thread.
+ * Returns false if the function couldn't be started, status is its' exit status then.
+ */
+bool start_stage_thread(lsh_ctx *ctx, lsh_command *command, lsh_builtin builtin, int input_fd, int output_fd, int error_fd, pthread_t *thread, int *status) {
+  stage_thread *stage = malloc(sizeof(stage_thread));
+  char failed[PATH_MAX];
+  int error;
+  sigset_t all_signals, previous_signals;
+
+  *status = 1;
+  if (stage == NULL || (stage->argv = copy_arguments(command->argv)) == NULL) {
+    dprintf(error_fd, "lsh: allocation error\n");
+    free(stage);
+    return false;
+  }
+  stage->ctx = ctx;
+  stage->builtin = builtin;
+  stage->fds[0] = fcntl(input_fd, F_DUPFD_CLOEXEC, 0);
+  stage->fds[LSH_STDOUT] = fcntl(output_fd, F_DUPFD_CLOEXEC, 0);
+  stage->fds[LSH_STDERR] = fcntl(error_fd, F_DUPFD_CLOEXEC, 0);
+  if (stage->fds[0] == -1 || stage->fds[LSH_STDOUT] == -1 || stage->fds[LSH_STDERR] == -1) {
+    dprintf(error_fd, "lsh: %s\n", strerror(errno));
+    free_stage(stage);
+    return false;
+  }
+
+  // Redirections take precedence over the pipes
+  if (!redirect_streams(ctx, command, stage->fds, failed, sizeof(failed))) {
+    dprintf(error_fd, "lsh: %s: %s\n", failed, strerror(errno));
+    free_stage(stage);
+    return false;
+  }
+
+  // The thread inherits the signal mask: with every signal blocked, the shell's handlers keep running
+  // on the main thread, and a write to a pipe whose reader quit fails with EPIPE instead of SIGPIPE
+  sigfillset(&all_signals);
+  pthread_sigmask(SIG_SETMASK, &all_signals, &previous_signals);
+
+  // The threads of a stopped pipeline carry on, maybe even after lsh_ctx_free(), so each one keeps the context
+  atomic_fetch_add(&ctx->references, 1);
+  error = pthread_create(thread, NULL, run_stage_thread, stage);
+  pthread_sigmask(SIG_SETMASK, &previous_signals, NULL);
+
+  if (error != 0) {
+    atomic_fetch_sub(&ctx->references, 1);
+    dprintf(error_fd, "lsh: %s: thread could not be created: %s\n", command->argv[0], strerror(error));
+    free_stage(stage);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Waits for the built-in function to finish and returns its' exit status
+ */
+int join_stage_thread(pthread_t thread) {
+  void *status;
+
+  if (pthread_join(thread, &status) != 0)
+    return 1;
+  return (int) (intptr_t) status;
+}
@@ -0,0 +1,19 @@
+/*
+ * stage_threads.h
+ * Runs the built-in functions which are a part of a pipeline on threads of the shell
+ */
+
+#ifndef LSH_STAGE_THREADS_H
+#define LSH_STAGE_THREADS_H
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#include "context.h"
+#include "default_functions.h"
+#include "parser.h"
+
+bool start_stage_thread(lsh_ctx *ctx, lsh_command *command, lsh_builtin builtin, int input_fd, int output_fd, int error_fd, pthread_t *thread, int *status);
+int join_stage_thread(pthread_t thread);
+
+#endif
@@ -0,0 +1,100 @@
+/*
+ * cache_interrupted.c
+ * Checks that the cache doesn't store the command lines which didn't run to the end:
+ * interrupted, stopped or cut short by the deadline
+ */
+
+#include <dirent.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../liblsh.h"
+
+#define INTERRUPT_AFTER 1 // Seconds
+#define GIVE_UP_AFTER 10
+
+static lsh_ctx *ctx;
+static char store[] = "/tmp/lsh-cache-XXXXXX";
+static volatile sig_atomic_t interrupt_signal;
+static volatile pid_t stopped_group;
+
+static void alarm_handler(int signal) {
+  if (interrupt_signal != 0) {
+    stopped_group = lsh_foreground_group(ctx);
+    lsh_interrupt(ctx, interrupt_signal);
+    interrupt_signal = 0;
+    alarm(GIVE_UP_AFTER);
+    return;
+  }
+  write(STDERR_FILENO, "the command line was not interrupted\n", 37);
+  _exit(1);
+}
+
+/**
+ * Counts the entries in the store
+ */
+static int count_entries() {
+  char path[PATH_MAX];
+  struct dirent *file;
+  DIR *directory;
+  int entries = 0;
+
+  snprintf(path, sizeof(path), "%s/entries", store);
+  if ((directory = opendir(path)) == NULL)
+    return 0;
+  while ((file = readdir(directory)) != NULL)
+    entries += file->d_name[0] != '.';
+  closedir(directory);
+  return entries;
+}
+
+/**
+ * Runs the line, sending it the signal after INTERRUPT_AFTER seconds unless it's 0,
+ * and checks the status and how many entries the store has afterwards
+ */
+static int check(const char *line, int signal, int expected_status, int expected_entries) {
+  int status, entries;
+
+  interrupt_signal = signal;
+  alarm(signal != 0 ? INTERRUPT_AFTER : GIVE_UP_AFTER);
+  status = lsh_eval(ctx, line);
+  alarm(0);
+
+  // A stopped command line is left in the background
+  if (stopped_group > 0) {
+    killpg(stopped_group, SIGKILL);
+    stopped_group = 0;
+  }
+  lsh_wait_background(ctx);
+
+  entries = count_entries();
+  printf("%s: %d, %d entries\n", line, status, entries);
+  return status == expected_status && entries == expected_entries ? 0 : 1;
+}
+
+int main() {
+  struct sigaction act_alarm = { .sa_handler = alarm_handler };
+  char command[PATH_MAX + 16];
+  int failures = 0;
+
+  sigaction(SIGALRM, &act_alarm, NULL);
+  if ((ctx = lsh_ctx_new()) == NULL || mkdtemp(store) == NULL)
+    return 1;
+  lsh_setenv(ctx, "LSH_CACHE_DIR", store);
+
+  failures += check("cache sleep 3 < /dev/null", SIGINT, 128 + SIGINT, 0);
+  failures += check("cache sleep 3 < /dev/null", SIGTSTP, 128 + SIGTSTP, 0);
+  failures += check("@deadline=1s cache sleep 3 < /dev/null", 0, 124, 0);
+  failures += check("cache timeout 1s sleep 3 < /dev/null", 0, 124, 0);
+
+  // The ones which finish are stored as usual
+  failures += check("cache sleep 0 < /dev/null", 0, 0, 1);
+
+  snprintf(command, sizeof(command), "rm -rf %s", store);
+  lsh_eval(ctx, command);
+  lsh_ctx_free(ctx);
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
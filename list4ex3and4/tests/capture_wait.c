@@ -0,0 +1,128 @@
+/*
+ * capture_wait.c
+ * Checks that the pipelines whose output is passed to the output callback are still
+ * waited for the same way as the others: their' deadlines are enforced while the output is drained,
+ * and the shell doesn't wait for the output of a stopped pipeline. The adaptive pipes grow as well.
+ * The program is its' own writer and reader of such a pipe with --write and --read.
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../liblsh.h"
+
+#define STOP_AFTER 1 // Seconds
+#define GIVE_UP_AFTER 10
+#define WRITTEN_SIZE 1048576 // What --write writes to the adaptive pipe
+#define READ_DELAY 500000 // How long --read leaves it full, in microseconds
+#define DEFAULT_PIPE_SIZE 65536
+
+static lsh_ctx *ctx;
+static size_t captured;
+static volatile sig_atomic_t stop_signal;
+static volatile pid_t stopped_group;
+
+static void count_output(lsh_ctx *ctx, int stream, const char *data, size_t length, void *user_data) {
+  captured += length;
+}
+
+static void alarm_handler(int signal) {
+  if (stop_signal != 0) {
+    stopped_group = lsh_foreground_group(ctx);
+    lsh_interrupt(ctx, stop_signal);
+    stop_signal = 0;
+    alarm(GIVE_UP_AFTER);
+    return;
+  }
+  write(STDERR_FILENO, "the pipeline was not waited for\n", 32);
+  _exit(1);
+}
+
+/**
+ * Runs the line and returns the status of its' last command, along with the time it took in seconds.
+ * The pipeline gets the signal after STOP_AFTER seconds, unless it's 0.
+ */
+static int run(const char *line, int signal, double *seconds) {
+  struct timespec start, end;
+  int status;
+
+  stop_signal = signal;
+  alarm(signal != 0 ? STOP_AFTER : GIVE_UP_AFTER);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  status = lsh_eval(ctx, line);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  alarm(0);
+
+  *seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  printf("%s: %d, %.3fs, %zu bytes\n", line, status, *seconds, captured);
+  return status;
+}
+
+/**
+ * --write fills the pipe, then quits with 0 if the shell has grown it
+ */
+static int write_pipe() {
+  static char data[WRITTEN_SIZE];
+  size_t written = 0;
+  ssize_t length;
+
+  while (written < sizeof(data) && (length = write(STDOUT_FILENO, data + written, sizeof(data) - written)) > 0)
+    written += length;
+  return fcntl(STDOUT_FILENO, F_GETPIPE_SZ) > DEFAULT_PIPE_SIZE ? 0 : 1;
+}
+
+/**
+ * --read stalls the writer for a while, then reads everything
+ */
+static int read_pipe() {
+  char buffer[DEFAULT_PIPE_SIZE];
+
+  usleep(READ_DELAY);
+  while (read(STDIN_FILENO, buffer, sizeof(buffer)) > 0)
+    continue;
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  struct sigaction act_alarm = { .sa_handler = alarm_handler };
+  char line[PATH_MAX * 2 + 32];
+  int statuses[2], failures = 0;
+  double seconds;
+
+  if (argc > 1)
+    return strcmp(argv[1], "--write") == 0 ? write_pipe() : read_pipe();
+
+  sigaction(SIGALRM, &act_alarm, NULL);
+  if ((ctx = lsh_ctx_new()) == NULL)
+    return 1;
+  lsh_set_output_callback(ctx, count_output, NULL);
+
+  // The deadline passes while the shell drains the output
+  if (run("timeout 1s sleep 3", 0, &seconds) != 124 || seconds > 2.5)
+    failures++;
+  if (run("timeout 1s cat /dev/zero", 0, &seconds) != 124 || seconds > 2.5 || captured == 0)
+    failures++;
+
+  // Ctrl-Z while the output is drained: the stopped pipeline is left in the background
+  if (run("cat /dev/zero", SIGTSTP, &seconds) != 128 + SIGTSTP || seconds > 2.5)
+    failures++;
+  if (stopped_group > 0)
+    killpg(stopped_group, SIGKILL);
+  lsh_wait_background(ctx);
+
+  // The writer stalls while the output is drained, the adaptive pipe has to grow in the meantime
+  snprintf(line, sizeof(line), "%s --write |{auto} %s --read", argv[0], argv[0]);
+  if (run(line, 0, &seconds) != 0 || lsh_pipeline_status(ctx, statuses, 2) != 2 || statuses[0] != 0)
+    failures++;
+
+  lsh_ctx_free(ctx);
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
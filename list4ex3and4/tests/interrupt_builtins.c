@@ -0,0 +1,97 @@
+/*
+ * interrupt_builtins.c
+ * Checks that the pipelines made only of builtins, which the shell runs on its' own threads
+ * without any process to signal, still stop when they're interrupted, and that the ones
+ * left running by a stopped pipeline quit when the context is freed
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../liblsh.h"
+
+#define INTERRUPT_AFTER 1 // Seconds
+#define GIVE_UP_AFTER 5
+
+static lsh_ctx *ctx;
+static volatile sig_atomic_t alarms, interrupt_signal = SIGINT;
+static volatile pid_t stopped_group;
+
+static void alarm_handler(int signal) {
+  if (alarms++ == 0) {
+    stopped_group = lsh_foreground_group(ctx);
+    lsh_interrupt(ctx, interrupt_signal);
+    alarm(GIVE_UP_AFTER);
+    return;
+  }
+  write(STDERR_FILENO, "the builtins were not interrupted\n", 34);
+  _exit(1);
+}
+
+/**
+ * Runs the line, interrupts it and checks the status of its' last command
+ */
+static int check(const char *line) {
+  int status;
+
+  alarms = 0;
+  alarm(INTERRUPT_AFTER);
+  status = lsh_eval(ctx, line);
+  alarm(0);
+
+  printf("%s: %d\n", line, status);
+  return status == 128 + SIGINT ? 0 : 1;
+}
+
+/**
+ * Stops the pipeline whose builtin waits for the stopped command, frees the context
+ * and checks that the builtin quits, closing its' output
+ */
+static int check_stopped(int output[2]) {
+  struct pollfd end = { .fd = output[0], .events = POLLIN };
+  char buffer[64];
+  int status, failed;
+
+  lsh_set_stdio(ctx, STDIN_FILENO, output[1], STDERR_FILENO);
+  alarms = 0;
+  interrupt_signal = SIGTSTP;
+  alarm(INTERRUPT_AFTER);
+  status = lsh_eval(ctx, "sleep 10 | cat");
+  alarm(0);
+
+  // The stopped command keeps the builtin's input open, only the context can make it quit
+  lsh_ctx_free(ctx);
+  close(output[1]);
+  failed = status != 128 + SIGTSTP || poll(&end, 1, GIVE_UP_AFTER * 1000) != 1 || read(output[0], buffer, sizeof(buffer)) != 0;
+  if (stopped_group > 0)
+    killpg(stopped_group, SIGKILL);
+
+  printf("sleep 10 | cat: %d\n", status);
+  return failed;
+}
+
+int main() {
+  struct sigaction act_alarm = { .sa_handler = alarm_handler };
+  int input[2], output[2], failures = 0;
+
+  sigaction(SIGALRM, &act_alarm, NULL);
+  // The commands mustn't inherit the pipes, only the builtins' own copies may keep them open
+  if ((ctx = lsh_ctx_new()) == NULL || pipe2(input, O_CLOEXEC) == -1 || pipe2(output, O_CLOEXEC) == -1)
+    return 1;
+
+  // A busy one, which never waits for its' input
+  failures += check("cat /dev/zero | tee /dev/null > /dev/null");
+
+  // Blocked on a pipe nobody writes to
+  lsh_set_stdio(ctx, input[0], STDOUT_FILENO, STDERR_FILENO);
+  failures += check("cat | cat");
+
+  failures += check_stopped(output);
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}